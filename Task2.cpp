@@ -4,143 +4,4149 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <array>
+#include <new>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <ctime>
 
-std::mutex coutMutex; // Mutex to protect console output from multiple threads
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#define HAVE_MMAP 1
+#endif
 
-// Compress a chunk of data using Run-Length Encoding (RLE)
-std::vector<char> compressRLEChunk(const std::vector<char>& data, size_t start, size_t end) {
-    std::vector<char> compressed;
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#define HAVE_AFFINITY 1
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#define HAVE_NEON 1
+#endif
+
+// Container format (version 2): header, chunk payloads, then the chunk table.
+// Legacy files start with a single 'C' or 'U' byte and are still readable.
+const char containerMagic[4] = {'R', 'L', 'E', 'X'};
+const uint8_t containerVersion = 2;
+const size_t containerHeaderSize = 32;
+const size_t chunkEntrySize = 24;
+const uint8_t containerFlagArchive = 0x01;  // payload is several files; a member table follows the chunk table
+const uint8_t containerFlagCrc32c = 0x02;   // chunk checksums are CRC32C rather than FNV-1a
+
+// On-disk header: magic, version, flags, codec, chunk count, original size, table offset
+struct ContainerHeader {
+    uint8_t version = containerVersion;
+    uint8_t flags = containerFlagCrc32c;
+    uint8_t codec = 0;  // codec requested at compression time; chunks may still differ
+    uint32_t chunkCount = 0;
+    uint64_t originalSize = 0;
+    uint64_t tableOffset = 0;
+};
+
+// One chunk table entry; offsets are absolute positions in the container file
+struct ChunkEntry {
+    uint64_t compressedOffset = 0;
+    uint32_t compressedLength = 0;
+    uint32_t decompressedLength = 0;
+    uint32_t checksum = 0;
+    uint8_t method = 0;  // ChunkMethod; the remaining three bytes are reserved
+};
+
+// Codec ID of a chunk payload (see the codec registry). Files written before
+// literal runs existed have zero here and therefore decode as plain pairs.
+enum ChunkMethod : uint8_t {
+    MethodRlePairs = 0,  // (byte, count) pairs, count 1..255
+    MethodStored = 1,    // raw bytes, used when encoding would not shrink the chunk
+    MethodPackBits = 2,  // control byte + literal stretch, or control byte + run byte
+    MethodLz77 = 3,      // LZ77 sequences: literals plus (offset, length) back-references
+    MethodVarintRle = 4, // varint control + literal stretch, or varint control + run byte
+    MethodRle16 = 5,     // (16-bit sample, 16-bit count) pairs
+    MethodRle32 = 6      // (32-bit sample, 16-bit count) pairs
+};
+
+// Store an unsigned integer in little-endian byte order
+template <typename T>
+void putLE(char* out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++)
+        out[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+// Load an unsigned integer stored in little-endian byte order
+template <typename T>
+T getLE(const char* in) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+        value |= static_cast<T>(static_cast<unsigned char>(in[i])) << (8 * i);
+    return value;
+}
+
+void writeContainerHeader(char* out, const ContainerHeader& header) {
+    std::memset(out, 0, containerHeaderSize);
+    std::memcpy(out, containerMagic, sizeof(containerMagic));
+    out[4] = static_cast<char>(header.version);
+    out[5] = static_cast<char>(header.flags);
+    out[6] = static_cast<char>(header.codec);
+    putLE<uint32_t>(out + 8, header.chunkCount);
+    putLE<uint64_t>(out + 16, header.originalSize);
+    putLE<uint64_t>(out + 24, header.tableOffset);
+}
+
+void writeChunkEntry(char* out, const ChunkEntry& entry) {
+    putLE<uint64_t>(out, entry.compressedOffset);
+    putLE<uint32_t>(out + 8, entry.compressedLength);
+    putLE<uint32_t>(out + 12, entry.decompressedLength);
+    putLE<uint32_t>(out + 16, entry.checksum);
+    putLE<uint32_t>(out + 20, entry.method);
+}
+
+ChunkEntry readChunkEntry(const char* in) {
+    ChunkEntry entry;
+    entry.compressedOffset = getLE<uint64_t>(in);
+    entry.compressedLength = getLE<uint32_t>(in + 8);
+    entry.decompressedLength = getLE<uint32_t>(in + 12);
+    entry.checksum = getLE<uint32_t>(in + 16);
+    entry.method = static_cast<uint8_t>(in[20]);
+    return entry;
+}
+
+bool isContainer(const char* data, size_t size) {
+    return size >= containerHeaderSize && std::memcmp(data, containerMagic, sizeof(containerMagic)) == 0;
+}
+
+// Parse and validate a container header against the total file size
+bool parseContainerHeader(const char* in, uint64_t fileSize, ContainerHeader& header) {
+    if (fileSize < containerHeaderSize || std::memcmp(in, containerMagic, sizeof(containerMagic)) != 0)
+        return false;
+    header.version = static_cast<uint8_t>(in[4]);
+    header.flags = static_cast<uint8_t>(in[5]);
+    header.codec = static_cast<uint8_t>(in[6]);
+    header.chunkCount = getLE<uint32_t>(in + 8);
+    header.originalSize = getLE<uint64_t>(in + 16);
+    header.tableOffset = getLE<uint64_t>(in + 24);
+
+    if (header.version != containerVersion) {
+        std::cerr << "Unsupported container version " << static_cast<int>(header.version) << ".\n";
+        return false;
+    }
+    if (header.tableOffset < containerHeaderSize || header.tableOffset > fileSize ||
+        (fileSize - header.tableOffset) / chunkEntrySize < header.chunkCount) {
+        std::cerr << "Corrupt chunk table.\n";
+        return false;
+    }
+    return true;
+}
+
+// Parse the chunk table and check every chunk lies inside the payload
+bool parseChunkTable(const char* table, const ContainerHeader& header, std::vector<ChunkEntry>& chunks) {
+    chunks.clear();
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < header.chunkCount; i++) {
+        ChunkEntry entry = readChunkEntry(table + i * chunkEntrySize);
+        if (entry.compressedOffset < containerHeaderSize || entry.compressedOffset > header.tableOffset ||
+            entry.compressedLength > header.tableOffset - entry.compressedOffset) {
+            std::cerr << "Chunk " << i << " lies outside the payload.\n";
+            return false;
+        }
+        total += entry.decompressedLength;
+        chunks.push_back(entry);
+    }
+    if (total != header.originalSize) {
+        std::cerr << "Chunk sizes do not add up to the original size.\n";
+        return false;
+    }
+    return true;
+}
+
+// Parse and validate the header and chunk table of an in-memory container
+bool parseContainer(const char* data, size_t size, ContainerHeader& header, std::vector<ChunkEntry>& chunks) {
+    if (!parseContainerHeader(data, size, header)) return false;
+    return parseChunkTable(data + header.tableOffset, header, chunks);
+}
+
+// Run-time statistics, collected only when --stats is given. With collection off
+// every probe is a single branch on statsEnabled, so the hot paths stay untouched.
+bool statsEnabled = false;
+
+enum Stage { StageRead, StageEncode, StageLayout, StageDecode, StageWrite, StageStream, StageCount };
+const char* const stageNames[StageCount] = {"read", "encode", "layout", "decode", "write", "stream"};
+
+// Slot 0 collects every thread outside the pool; pool worker i uses slot i + 1
+const unsigned int maxStatsThreads = 1025;
+thread_local unsigned int statsThreadSlot = 0;
+
+struct StageStats {
+    std::atomic<uint64_t> wallNs{0}, cpuNs{0}, bytes{0}, calls{0};
+};
+
+struct alignas(64) ThreadStats {
+    std::atomic<uint64_t> bytes{0}, busyNs{0}, idleNs{0}, tasks{0};
+};
+
+struct RunStats {
+    StageStats stages[StageCount];
+    ThreadStats threads[maxStatsThreads];
+    const char* streamIo = nullptr;  // how the last streamed compression did its I/O
+};
+
+RunStats& runStats() {
+    static RunStats stats;
+    return stats;
+}
+
+uint64_t monotonicNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// CPU time of the whole process, all threads included
+uint64_t processCpuNs() {
+#ifdef HAVE_MMAP
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+#else
+    return static_cast<uint64_t>(std::clock()) * (1000000000ull / CLOCKS_PER_SEC);
+#endif
+}
+
+// Scoped wall and CPU time of one stage. CPU time is process-wide while the stage
+// runs, so it includes the workers; stages that overlap (the loader reading ahead)
+// share it. Bytes can be added once they are known.
+class StageTimer {
+public:
+    explicit StageTimer(Stage timedStage, uint64_t initialBytes = 0) : stage(timedStage), bytes(initialBytes) {
+        if (!statsEnabled) return;
+        wallStart = monotonicNs();
+        cpuStart = processCpuNs();
+    }
+
+    ~StageTimer() { finish(); }
+
+    void addBytes(uint64_t count) { bytes += count; }
+
+    // Record the stage now instead of at the end of the scope
+    void finish() {
+        if (!wallStart) return;
+        StageStats& s = runStats().stages[stage];
+        s.wallNs += monotonicNs() - wallStart;
+        s.cpuNs += processCpuNs() - cpuStart;
+        s.bytes += bytes;
+        s.calls++;
+        wallStart = 0;
+    }
+
+private:
+    Stage stage;
+    uint64_t bytes;
+    uint64_t wallStart = 0, cpuStart = 0;
+};
+
+// Live progress (--progress). Each thread adds the bytes of every finished work item
+// to its own cache-line-sized counter with a relaxed atomic add; the reporter thread
+// only reads them, so workers never wait on each other or on the console.
+bool progressEnabled = false;
+
+struct alignas(64) ProgressCounter {
+    std::atomic<uint64_t> bytes{0};
+};
+
+ProgressCounter progressCounters[maxStatsThreads];
+
+uint64_t progressBytes() {
+    uint64_t total = 0;
+    for (const ProgressCounter& counter : progressCounters) total += counter.bytes.load(std::memory_order_relaxed);
+    return total;
+}
+
+// Scoped busy time and bytes of one work item, charged to the running thread
+class WorkTimer {
+public:
+    explicit WorkTimer(uint64_t bytes) : bytes(bytes), start(statsEnabled ? monotonicNs() : 0) {}
+
+    ~WorkTimer() {
+        if (progressEnabled) progressCounters[statsThreadSlot].bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (!start) return;
+        ThreadStats& t = runStats().threads[statsThreadSlot];
+        t.busyNs += monotonicNs() - start;
+        t.bytes += bytes;
+        t.tasks++;
+    }
+
+private:
+    uint64_t bytes;
+    uint64_t start;
+};
+
+// Write the collected statistics to `path` ("-" for stdout): JSON, or the Prometheus
+// text format when the name ends in ".prom". Files are replaced atomically so a
+// textfile collector never reads a half-written file.
+bool writeStats(const std::string& path, unsigned int poolThreads) {
+    const RunStats& stats = runStats();
+    bool prometheus = path.size() > 5 && path.compare(path.size() - 5, 5, ".prom") == 0;
+    auto seconds = [](uint64_t ns) { return static_cast<double>(ns) / 1e9; };
+
+    std::ostringstream text;
+    text << std::setprecision(9);
+    if (prometheus) {
+        const char* stageMetrics[][3] = {
+            {"rlex_stage_wall_seconds_total", "Wall time spent in each stage.", "wall"},
+            {"rlex_stage_cpu_seconds_total", "Process CPU time while each stage ran.", "cpu"},
+            {"rlex_stage_bytes_total", "Bytes handled by each stage.", "bytes"},
+            {"rlex_stage_calls_total", "Times each stage ran.", "calls"}};
+        for (auto& metric : stageMetrics) {
+            text << "# HELP " << metric[0] << " " << metric[1] << "\n# TYPE " << metric[0] << " counter\n";
+            for (int s = 0; s < StageCount; s++) {
+                const StageStats& st = stats.stages[s];
+                std::string field = metric[2];
+                text << metric[0] << "{stage=\"" << stageNames[s] << "\"} ";
+                if (field == "wall") text << seconds(st.wallNs);
+                else if (field == "cpu") text << seconds(st.cpuNs);
+                else if (field == "bytes") text << st.bytes;
+                else text << st.calls;
+                text << "\n";
+            }
+        }
+        if (stats.streamIo)
+            text << "# HELP rlex_stream_io_info I/O backend of the last streamed compression.\n"
+                 << "# TYPE rlex_stream_io_info gauge\nrlex_stream_io_info{backend=\"" << stats.streamIo << "\"} 1\n";
+        const char* threadMetrics[][3] = {
+            {"rlex_thread_bytes_total", "Bytes encoded or decoded by each thread.", "bytes"},
+            {"rlex_thread_busy_seconds_total", "Time each thread spent encoding or decoding.", "busy"},
+            {"rlex_thread_idle_seconds_total", "Time each pool worker spent waiting for work.", "idle"}};
+        for (auto& metric : threadMetrics) {
+            text << "# HELP " << metric[0] << " " << metric[1] << "\n# TYPE " << metric[0] << " counter\n";
+            for (unsigned int i = 0; i <= poolThreads && i < maxStatsThreads; i++) {
+                const ThreadStats& t = stats.threads[i];
+                std::string field = metric[2];
+                text << metric[0] << "{thread=\"" << (i == 0 ? std::string("other") : std::to_string(i - 1)) << "\"} ";
+                if (field == "bytes") text << t.bytes;
+                else if (field == "busy") text << seconds(t.busyNs);
+                else text << seconds(t.idleNs);
+                text << "\n";
+            }
+        }
+    } else {
+        text << "{\n  \"threads\": " << poolThreads << ",";
+        if (stats.streamIo) text << "\n  \"stream_io\": \"" << stats.streamIo << "\",";
+        text << "\n  \"stages\": {";
+        for (int s = 0; s < StageCount; s++) {
+            const StageStats& st = stats.stages[s];
+            text << (s ? "," : "") << "\n    \"" << stageNames[s] << "\": {\"wall_seconds\": " << seconds(st.wallNs)
+                 << ", \"cpu_seconds\": " << seconds(st.cpuNs) << ", \"bytes\": " << st.bytes
+                 << ", \"calls\": " << st.calls << "}";
+        }
+        text << "\n  },\n  \"workers\": [";
+        for (unsigned int i = 0; i <= poolThreads && i < maxStatsThreads; i++) {
+            const ThreadStats& t = stats.threads[i];
+            text << (i ? "," : "") << "\n    {\"thread\": "
+                 << (i == 0 ? std::string("\"other\"") : std::to_string(i - 1)) << ", \"bytes\": " << t.bytes
+                 << ", \"tasks\": " << t.tasks << ", \"busy_seconds\": " << seconds(t.busyNs)
+                 << ", \"idle_seconds\": " << seconds(t.idleNs) << "}";
+        }
+        text << "\n  ]\n}\n";
+    }
+
+    if (path == "-") {
+        std::cout << text.str();
+        return static_cast<bool>(std::cout);
+    }
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        out << text.str();
+        if (!out.flush()) {
+            std::cerr << "Failed to write " << temp << "\n";
+            return false;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write " << path << "\n";
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reporter thread for --progress: samples the per-thread counters at a fixed
+// interval and redraws one status line on stderr (percentage and ETA only when
+// the total is known). Does nothing unless progressEnabled is set.
+class ProgressReporter {
+public:
+    explicit ProgressReporter(uint64_t totalBytes) : total(totalBytes) {
+        if (!progressEnabled) return;
+        baseline = progressBytes();
+        started = std::chrono::steady_clock::now();
+        thread = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(m);
+            while (!cv.wait_for(lock, interval, [this]() { return stopping; })) draw(false);
+        });
+    }
+
+    ~ProgressReporter() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+        draw(true);
+    }
+
+    // Print a line (to stdout by default) without it being glued to the status line
+    void print(const std::string& text, std::ostream& stream = std::cout) {
+        std::lock_guard<std::mutex> lock(m);
+        if (thread.joinable()) std::cerr << "\r" << std::string(64, ' ') << "\r" << std::flush;
+        stream << text << std::flush;
+    }
+
+private:
+    void draw(bool last) {
+        uint64_t done = progressBytes() - baseline;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        double rate = seconds > 0 ? static_cast<double>(done) / seconds : 0;
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1);
+        if (total > 0) line << 100.0 * static_cast<double>(std::min(done, total)) / static_cast<double>(total) << "%  ";
+        line << static_cast<double>(done) / 1e6 << " MB";
+        if (total > 0) line << " / " << static_cast<double>(total) / 1e6 << " MB";
+        line << "  " << rate / 1e6 << " MB/s";
+        if (total > 0 && rate > 0 && !last) {
+            uint64_t eta = static_cast<uint64_t>(static_cast<double>(total - std::min(done, total)) / rate);
+            line << "  ETA " << eta / 60 << ":" << std::setw(2) << std::setfill('0') << eta % 60;
+        }
+        std::cerr << "\r" << std::left << std::setw(64) << line.str() << (last ? "\n" : "") << std::flush;
+    }
+
+    const std::chrono::milliseconds interval{250};
+    uint64_t total;
+    uint64_t baseline = 0;
+    std::chrono::steady_clock::time_point started;
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+};
+
+// Pin pool workers to CPUs grouped by NUMA node (--pin). Workers are laid out
+// node by node, steal from their own node first, and recycle buffers within it.
+bool pinWorkers = false;
+
+// NUMA node of the calling thread; 0 unless it is a pinned worker
+const unsigned int maxNumaNodes = 8;
+thread_local unsigned int currentNumaNode = 0;
+
+// Parse a sysfs CPU list such as "0-3,8-11"
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty() || !std::isdigit(static_cast<unsigned char>(range[0]))) continue;
+        size_t dash = range.find('-');
+        int first = std::atoi(range.c_str());
+        int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// CPUs of each NUMA node from /sys/devices/system/node, limited to the CPUs this
+// process may run on. Without that topology every allowed CPU is one node.
+std::vector<std::vector<int>> numaTopology() {
+    std::vector<std::vector<int>> nodes;
+#ifdef HAVE_AFFINITY
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return nodes;
+    for (unsigned int node = 0; node < 1024 && nodes.size() < maxNumaNodes; node++) {
+        std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!list) {
+            if (node >= 64) break;  // node numbers can have gaps, but not this many
+            continue;
+        }
+        std::string text;
+        std::getline(list, text);
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(text))
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+#endif
+    return nodes;
+}
+
+// Where a pinned worker runs
+struct WorkerPlacement {
+    unsigned int node = 0;
+    int cpu = -1;  // -1 leaves the thread unpinned
+};
+
+// Spread `count` workers over the nodes in contiguous groups, in proportion to each
+// node's CPU count, and give each worker its own CPU within its node where possible
+std::vector<WorkerPlacement> placeWorkers(unsigned int count) {
+    std::vector<WorkerPlacement> placements(count);
+    std::vector<std::vector<int>> nodes = numaTopology();
+    size_t totalCpus = 0;
+    for (const auto& cpus : nodes) totalCpus += cpus.size();
+    if (totalCpus == 0) return placements;
+
+    size_t worker = 0;
+    size_t cpusBefore = 0;
+    for (unsigned int node = 0; node < nodes.size(); node++) {
+        cpusBefore += nodes[node].size();
+        size_t end = (node + 1 == nodes.size()) ? count : count * cpusBefore / totalCpus;
+        for (size_t k = 0; worker < end; worker++, k++) {
+            placements[worker].node = node;
+            placements[worker].cpu = nodes[node][k % nodes[node].size()];
+        }
+    }
+    return placements;
+}
+
+// Bind the calling thread to one CPU; false if the kernel refuses
+bool pinCurrentThread(int cpu) {
+#ifdef HAVE_AFFINITY
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Persistent work-stealing thread pool shared by all compression paths.
+// Each worker owns a deque: it pops its own newest task and steals the oldest
+// task from the other workers when its own deque runs dry. With pinWorkers set,
+// each worker is bound to a CPU and steals from workers on its own node first.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int numThreads) : workerCount(numThreads ? numThreads : 1) {
+        placements.resize(workerCount);
+        if (pinWorkers) placements = placeWorkers(workerCount);
+        for (unsigned int i = 0; i < workerCount; i++)
+            queues.emplace_back(new WorkerQueue);
+        threads.reserve(workerCount);
+        for (unsigned int i = 0; i < workerCount; i++)
+            threads.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCv.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    // Fixed before any worker starts, so workers never read `threads` while it grows
+    unsigned int size() const { return workerCount; }
+
+    // Queue a task; tasks submitted from a worker go to that worker's own deque
+    void submit(std::function<void()> task) {
+        submitTo((currentPool == this) ? currentWorker : nextQueue.fetch_add(1) % size(), std::move(task));
+    }
+
+    // Queue a task on a given worker's deque; others may still steal it
+    void submitTo(unsigned int index, std::function<void()> task) {
+        index %= size();
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->m);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending++;
+        }
+        sleepCv.notify_one();
+    }
+
+    // Run one queued task on the calling thread; returns false if none was available
+    bool runPendingTask() {
+        std::function<void()> task;
+        unsigned int home = (currentPool == this) ? currentWorker : 0;
+        if (!takeTask(home, task)) return false;
+        task();
+        return true;
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Pop from the back of our own deque, otherwise steal from the front of another;
+    // pinned workers look at their own node's deques before remote ones
+    bool takeTask(unsigned int home, std::function<void()>& task) {
+        unsigned int passes = pinWorkers ? 2 : 1;
+        for (unsigned int pass = 0; pass < passes; pass++)
+            for (unsigned int n = 0; n < size(); n++) {
+                unsigned int index = (home + n) % size();
+                bool local = placements[index].node == placements[home].node;
+                if (passes == 2 && local != (pass == 0)) continue;
+                if (tryTake(index, index == home, task)) return true;
+            }
+        return false;
+    }
+
+    // Take the newest task of our own deque or the oldest of another worker's
+    bool tryTake(unsigned int index, bool own, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(queues[index]->m);
+        auto& tasks = queues[index]->tasks;
+        if (tasks.empty()) return false;
+        if (own) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        std::lock_guard<std::mutex> sleepLock(sleepMutex);
+        pending--;
+        return true;
+    }
+
+    void workerLoop(unsigned int index) {
+        currentPool = this;
+        currentWorker = index;
+        statsThreadSlot = std::min(index + 1, maxStatsThreads - 1);
+        if (placements[index].cpu >= 0 && pinCurrentThread(placements[index].cpu))
+            currentNumaNode = std::min(placements[index].node, maxNumaNodes - 1);
+        while (true) {
+            std::function<void()> task;
+            if (takeTask(index, task)) {
+                task();
+                continue;
+            }
+            uint64_t idleStart = statsEnabled ? monotonicNs() : 0;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCv.wait(lock, [this]() { return stopping || pending > 0; });
+            if (idleStart) runStats().threads[statsThreadSlot].idleNs += monotonicNs() - idleStart;
+            if (stopping && pending == 0) return;
+        }
+    }
+
+    const unsigned int workerCount;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<WorkerPlacement> placements;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCv;
+    long long pending = 0; // may dip below zero briefly between a push and its count
+    bool stopping = false;
+    std::atomic<unsigned int> nextQueue{0};
+
+    static thread_local ThreadPool* currentPool;
+    static thread_local unsigned int currentWorker;
+};
+
+thread_local ThreadPool* ThreadPool::currentPool = nullptr;
+thread_local unsigned int ThreadPool::currentWorker = 0;
+
+// Tracks a batch of pool tasks so the submitter can wait for all of them.
+// A waiting thread helps run queued tasks, so nested waits cannot starve the pool.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool) : pool(pool) {}
+    ~TaskGroup() { wait(); }
+
+    void run(std::function<void()> task) {
+        outstanding++;
+        pool.submit(wrap(std::move(task)));
+    }
+
+    // Like run(), but queue the task on a given worker
+    void runOn(unsigned int worker, std::function<void()> task) {
+        outstanding++;
+        pool.submitTo(worker, wrap(std::move(task)));
+    }
+
+    void wait() {
+        while (outstanding > 0) {
+            if (pool.runPendingTask()) continue;
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [this]() { return outstanding == 0; });
+        }
+        // Wait for the last task to release the mutex before the group can go away
+        std::lock_guard<std::mutex> lock(m);
+    }
+
+private:
+    std::function<void()> wrap(std::function<void()> task) {
+        return [this, task]() {
+            task();
+            std::lock_guard<std::mutex> lock(m);
+            if (--outstanding == 0) cv.notify_all();
+        };
+    }
+
+    ThreadPool& pool;
+    std::atomic<size_t> outstanding{0};
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+// Worker count for the shared pool; 0 means one per hardware thread
+unsigned int configuredThreads = 0;
+std::unique_ptr<ThreadPool> sharedPool;
+
+// Size the pool has or will have, without starting it
+unsigned int resolvedThreadCount() {
+    unsigned int numThreads = configuredThreads;
+    if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0) numThreads = 2;
+    return numThreads;
+}
+
+// The process-wide pool, created on first use
+ThreadPool& threadPool() {
+    if (!sharedPool) sharedPool.reset(new ThreadPool(resolvedThreadCount()));
+    return *sharedPool;
+}
+
+// Change the pool size; the pool is rebuilt lazily on next use
+void setThreadCount(unsigned int numThreads) {
+    configuredThreads = numThreads;
+    sharedPool.reset();
+}
+
+// Inputs below this size are processed inline on the calling thread: handing a few
+// hundred KB to the pool costs more in wake-ups and hand-offs than the work itself
+const size_t smallInputThreshold = 256u << 10;
+
+// Run fn(0..count-1) as pool tasks and wait for all of them. Work on fewer than
+// smallInputThreshold bytes (or a single item) runs inline without touching the pool.
+// Pinned workers get contiguous index ranges, so each node works on its own slice
+// of the buffer and only steals across nodes once its slice is done.
+void parallelFor(size_t count, const std::function<void(size_t)>& fn, size_t totalBytes = SIZE_MAX) {
+    if (count <= 1 || totalBytes < smallInputThreshold) {
+        for (size_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+    ThreadPool& pool = threadPool();
+    TaskGroup group(pool);
+    for (size_t i = 0; i < count; i++) {
+        if (pinWorkers) group.runOn(static_cast<unsigned int>(i * pool.size() / count), [&fn, i]() { fn(i); });
+        else group.run([&fn, i]() { fn(i); });
+    }
+    group.wait();
+}
+
+// Worst-case RLE output size for a chunk: one (byte, count) pair per input byte
+size_t rleBound(size_t size) { return 2 * size; }
+
+// Run scanning kernels. runLength() returns how many leading bytes of p[0..max)
+// equal p[0]; literalLength() returns how many leading bytes differ from their
+// successor, i.e. the offset of the first run of two or more (max if none).
+size_t runLengthScalar(const char* p, size_t max) {
+    size_t n = 1;
+    while (n < max && p[n] == p[0]) n++;
+    return n;
+}
+
+size_t literalLengthScalar(const char* p, size_t max) {
+    size_t n = 0;
+    while (n + 1 < max && p[n] != p[n + 1]) n++;
+    return (n + 1 < max) ? n : max;
+}
+
+#ifdef HAVE_X86_SIMD
+size_t runLengthSSE2(const char* p, size_t max) {
+    const __m128i c = _mm_set1_epi8(p[0]);
+    size_t n = 0;
+    for (; n + 16 <= max; n += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n)), c));
+        if (mask != 0xFFFF) return n + __builtin_ctz(~mask);
+    }
+    while (n < max && p[n] == p[0]) n++;
+    return n;
+}
+
+size_t literalLengthSSE2(const char* p, size_t max) {
+    size_t n = 0;
+    for (; n + 17 <= max; n += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n + 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (mask != 0) return n + __builtin_ctz(mask);
+    }
+    return n + literalLengthScalar(p + n, max - n);
+}
+
+__attribute__((target("avx2")))
+size_t runLengthAVX2(const char* p, size_t max) {
+    const __m256i c = _mm256_set1_epi8(p[0]);
+    size_t n = 0;
+    for (; n + 32 <= max; n += 32) {
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n)), c)));
+        if (mask != 0xFFFFFFFFu) return n + __builtin_ctz(~mask);
+    }
+    while (n < max && p[n] == p[0]) n++;
+    return n;
+}
+
+__attribute__((target("avx2")))
+size_t literalLengthAVX2(const char* p, size_t max) {
+    size_t n = 0;
+    for (; n + 33 <= max; n += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n + 1));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        if (mask != 0) return n + __builtin_ctz(mask);
+    }
+    return n + literalLengthSSE2(p + n, max - n);
+}
+#endif
+
+#ifdef HAVE_NEON
+size_t runLengthNEON(const char* p, size_t max) {
+    const uint8x16_t c = vdupq_n_u8(static_cast<uint8_t>(p[0]));
+    size_t n = 0;
+    for (; n + 16 <= max; n += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p + n)), c);
+        if (vminvq_u8(eq) != 0xFF) break;
+    }
+    while (n < max && p[n] == p[0]) n++;
+    return n;
+}
+
+size_t literalLengthNEON(const char* p, size_t max) {
+    size_t n = 0;
+    for (; n + 17 <= max; n += 16) {
+        uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(p + n));
+        uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(p + n + 1));
+        if (vmaxvq_u8(vceqq_u8(a, b)) != 0) break;
+    }
+    return n + literalLengthScalar(p + n, max - n);
+}
+#endif
+
+// Run expansion kernels: decode (byte, count) pairs into a preallocated slice of
+// exactly outSize bytes. Short runs are one broadcast store when the slice has room
+// for the full vector (never past outEnd, which may belong to another thread);
+// long runs are a loop of wide stores finished with an overlapping tail store.
+bool expandPairsScalar(const char* data, size_t size, char* out, size_t outSize) {
+    char* pos = out;
+    char* outEnd = out + outSize;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        unsigned char count = static_cast<unsigned char>(data[i + 1]);
+        if (count > static_cast<size_t>(outEnd - pos)) return false;
+        std::memset(pos, data[i], count);
+        pos += count;
+    }
+    return pos == outEnd;
+}
+
+#ifdef HAVE_X86_SIMD
+bool expandPairsSSE2(const char* data, size_t size, char* out, size_t outSize) {
+    char* pos = out;
+    char* outEnd = out + outSize;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        unsigned char count = static_cast<unsigned char>(data[i + 1]);
+        size_t room = static_cast<size_t>(outEnd - pos);
+        if (count > room) return false;
+        __m128i v = _mm_set1_epi8(data[i]);
+        if (count <= 16) {
+            if (room >= 16) _mm_storeu_si128(reinterpret_cast<__m128i*>(pos), v);
+            else std::memset(pos, data[i], count);
+        } else {
+            size_t k = 0;
+            for (; k + 16 <= count; k += 16)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(pos + k), v);
+            if (k < count) _mm_storeu_si128(reinterpret_cast<__m128i*>(pos + count - 16), v);
+        }
+        pos += count;
+    }
+    return pos == outEnd;
+}
+
+__attribute__((target("avx2")))
+bool expandPairsAVX2(const char* data, size_t size, char* out, size_t outSize) {
+    char* pos = out;
+    char* outEnd = out + outSize;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        unsigned char count = static_cast<unsigned char>(data[i + 1]);
+        size_t room = static_cast<size_t>(outEnd - pos);
+        if (count > room) return false;
+        __m256i v = _mm256_set1_epi8(data[i]);
+        if (count <= 32) {
+            if (room >= 32) _mm256_storeu_si256(reinterpret_cast<__m256i*>(pos), v);
+            else std::memset(pos, data[i], count);
+        } else {
+            size_t k = 0;
+            for (; k + 32 <= count; k += 32)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(pos + k), v);
+            if (k < count) _mm256_storeu_si256(reinterpret_cast<__m256i*>(pos + count - 32), v);
+        }
+        pos += count;
+    }
+    return pos == outEnd;
+}
+#endif
+
+#ifdef HAVE_NEON
+bool expandPairsNEON(const char* data, size_t size, char* out, size_t outSize) {
+    char* pos = out;
+    char* outEnd = out + outSize;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        unsigned char count = static_cast<unsigned char>(data[i + 1]);
+        size_t room = static_cast<size_t>(outEnd - pos);
+        if (count > room) return false;
+        uint8x16_t v = vdupq_n_u8(static_cast<uint8_t>(data[i]));
+        uint8_t* dst = reinterpret_cast<uint8_t*>(pos);
+        if (count <= 16) {
+            if (room >= 16) vst1q_u8(dst, v);
+            else std::memset(pos, data[i], count);
+        } else {
+            size_t k = 0;
+            for (; k + 16 <= count; k += 16) vst1q_u8(dst + k, v);
+            if (k < count) vst1q_u8(dst + count - 16, v);
+        }
+        pos += count;
+    }
+    return pos == outEnd;
+}
+#endif
+
+// Run scanners and expanders picked once per process from what the CPU supports
+struct RleKernels {
+    const char* name;
+    size_t (*runLength)(const char*, size_t);
+    size_t (*literalLength)(const char*, size_t);
+    bool (*expandPairs)(const char*, size_t, char*, size_t);
+};
+
+// Force the scalar kernels, e.g. to cross-check SIMD output against them
+bool forceScalarKernels = false;
+
+const RleKernels& rleKernels() {
+    static const RleKernels kernels = []() {
+        const RleKernels scalar{"scalar", runLengthScalar, literalLengthScalar, expandPairsScalar};
+        if (forceScalarKernels) return scalar;
+#if defined(HAVE_X86_SIMD)
+        if (__builtin_cpu_supports("avx2"))
+            return RleKernels{"avx2", runLengthAVX2, literalLengthAVX2, expandPairsAVX2};
+        if (__builtin_cpu_supports("sse2"))
+            return RleKernels{"sse2", runLengthSSE2, literalLengthSSE2, expandPairsSSE2};
+#elif defined(HAVE_NEON)
+        return RleKernels{"neon", runLengthNEON, literalLengthNEON, expandPairsNEON};
+#endif
+        return scalar;
+    }();
+    return kernels;
+}
+
+// Chunk checksums. Files written now carry CRC32C (Castagnoli), which SSE4.2 and
+// ARMv8 compute in hardware at several bytes per cycle; files whose header lacks
+// the CRC32C flag carry the FNV-1a checksum used before and are still verified.
+enum ChecksumType : uint8_t { ChecksumFnv1a, ChecksumCrc32c };
+
+uint32_t fnv1aChecksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Table-driven CRC32C (slicing by 8) for hosts without a CRC instruction
+uint32_t crc32cScalar(const char* data, size_t size) {
+    static const auto tables = []() {
+        std::vector<std::array<uint32_t, 256>> t(8);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+            for (int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        return t;
+    }();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t low = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24));
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^
+              tables[4][low >> 24] ^ tables[3][p[4]] ^ tables[2][p[5]] ^ tables[1][p[6]] ^ tables[0][p[7]];
+    }
+    for (; size > 0; size--, p++) crc = (crc >> 8) ^ tables[0][(crc ^ *p) & 0xFF];
+    return ~crc;
+}
+
+#if defined(HAVE_X86_SIMD) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cSSE42(const char* data, size_t size) {
+    uint64_t crc = 0xFFFFFFFFu;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc);
+    for (; size > 0; size--, data++) crc32 = _mm_crc32_u8(crc32, static_cast<unsigned char>(*data));
+    return ~crc32;
+}
+#elif defined(HAVE_NEON) && defined(__ARM_FEATURE_CRC32)
+uint32_t crc32cARMv8(const char* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; size--, data++) crc = __crc32cb(crc, static_cast<uint8_t>(*data));
+    return ~crc;
+}
+#endif
+
+// CRC32C with the fastest kernel this CPU supports (--scalar forces the table)
+uint32_t crc32c(const char* data, size_t size) {
+    static uint32_t (*const kernel)(const char*, size_t) = []() {
+        if (forceScalarKernels) return crc32cScalar;
+#if defined(HAVE_X86_SIMD) && defined(__x86_64__)
+        if (__builtin_cpu_supports("sse4.2")) return crc32cSSE42;
+#elif defined(HAVE_NEON) && defined(__ARM_FEATURE_CRC32)
+        return crc32cARMv8;
+#endif
+        return crc32cScalar;
+    }();
+    return kernel(data, size);
+}
+
+// Checksum of the original bytes of a chunk
+uint32_t chunkChecksum(const char* data, size_t size, ChecksumType type = ChecksumCrc32c) {
+    return type == ChecksumCrc32c ? crc32c(data, size) : fnv1aChecksum(data, size);
+}
+
+// Compress a chunk of data using Run-Length Encoding (RLE) into `out`, which holds
+// `capacity` bytes (rleBound(end - start) always suffices). Returns the number of
+// bytes written, or a value above capacity if the encoding did not fit.
+// Literal stretches become (byte, 1) pairs; runs are capped at 255 per pair.
+size_t compressRLEChunk(const char* data, size_t start, size_t end, char* out, size_t capacity) {
+    const RleKernels& kernels = rleKernels();
+    char* pos = out;
+    char* outEnd = out + capacity;
     size_t i = start;
     while (i < end) {
-        char c = data[i];
-        size_t count = 1;
-        while (i + count < end && data[i + count] == c && count < 255)
-            count++;
-        compressed.push_back(c);
-        compressed.push_back(static_cast<char>(count));
+        size_t literal = kernels.literalLength(data + i, end - i);
+        if (2 * literal > static_cast<size_t>(outEnd - pos)) return capacity + 1;
+        for (size_t k = 0; k < literal; k++) {
+            *pos++ = data[i + k];
+            *pos++ = 1;
+        }
+        i += literal;
+        if (i >= end) break;
+        if (outEnd - pos < 2) return capacity + 1;
+
+        size_t count = kernels.runLength(data + i, std::min<size_t>(end - i, 255));
+        *pos++ = data[i];
+        *pos++ = static_cast<char>(count);
         i += count;
     }
-    return compressed;
+    return static_cast<size_t>(pos - out);
+}
+
+// Number of bytes a run of RLE pairs expands to
+size_t rleDecodedSize(const char* data, size_t size) {
+    size_t total = 0;
+    for (size_t i = 1; i < size; i += 2)
+        total += static_cast<unsigned char>(data[i]);
+    return total;
+}
+
+// Decompress a chunk of RLE-compressed data from a view straight into `out`.
+// Fails on an odd-sized chunk or unless it expands to exactly outSize bytes;
+// callers report failures once per chunk.
+bool decompressRLEChunk(const char* data, size_t size, char* out, size_t outSize) {
+    if (size % 2 != 0) return false;
+    return rleKernels().expandPairs(data, size, out, outSize);
+}
+
+// PackBits-style literal-run encoding. A control byte below 128 is followed by
+// control + 1 literal bytes; a control byte of 128 or more is followed by one byte
+// repeated control - 125 times (3..130). Incompressible input grows by at most
+// one byte per 128, and runs shorter than three stay inside literal stretches.
+const size_t packBitsMaxLiteral = 128;
+const size_t packBitsMinRun = 3;
+const size_t packBitsMaxRun = 130;
+
+size_t packBitsBound(size_t size) { return size + (size + packBitsMaxLiteral - 1) / packBitsMaxLiteral; }
+
+// Encode data[0..size) into `out` (at least packBitsBound(size) bytes); returns bytes written
+size_t compressPackBitsChunk(const char* data, size_t size, char* out) {
+    const RleKernels& kernels = rleKernels();
+    char* pos = out;
+    size_t i = 0;
+    while (i < size) {
+        // Extend the literal stretch past runs too short to be worth a run token
+        size_t literalStart = i;
+        size_t run = 0;
+        while (i < size) {
+            i += kernels.literalLength(data + i, size - i);
+            if (i >= size) break;
+            run = kernels.runLength(data + i, std::min(size - i, packBitsMaxRun));
+            if (run >= packBitsMinRun) break;
+            i += run;
+            run = 0;
+        }
+
+        for (size_t lit = literalStart; lit < i; ) {
+            size_t n = std::min(i - lit, packBitsMaxLiteral);
+            *pos++ = static_cast<char>(n - 1);
+            std::memcpy(pos, data + lit, n);
+            pos += n;
+            lit += n;
+        }
+
+        if (run >= packBitsMinRun) {
+            *pos++ = static_cast<char>(run - packBitsMinRun + 128);
+            *pos++ = data[i];
+            i += run;
+        }
+    }
+    return static_cast<size_t>(pos - out);
+}
+
+// Decode a PackBits chunk into exactly outSize bytes
+bool decompressPackBitsChunk(const char* data, size_t size, char* out, size_t outSize) {
+    size_t i = 0, pos = 0;
+    while (i < size) {
+        unsigned char control = static_cast<unsigned char>(data[i++]);
+        if (control < 128) {
+            size_t n = control + 1u;
+            if (n > size - i || n > outSize - pos) return false;
+            std::memcpy(out + pos, data + i, n);
+            i += n;
+            pos += n;
+        } else {
+            size_t n = control - 128u + packBitsMinRun;
+            if (i >= size || n > outSize - pos) return false;
+            std::memset(out + pos, data[i++], n);
+            pos += n;
+        }
+    }
+    return pos == outSize;
+}
+
+// Run-length encoding with varint lengths, so a run of any length is one token.
+// Each token starts with a LEB128 control value: (count - 1) << 1 for a literal
+// stretch, followed by the bytes, or (length - 3) << 1 | 1 for a run, followed by
+// the repeated byte. A 1 MiB zero region takes four bytes instead of the ~4100
+// pairs of the 255-capped codec, and decodes with a single memset.
+const size_t varintMinRun = 3;
+
+size_t varintRleBound(size_t size) { return size + size / 64 + 16; }
+
+char* writeVarint(char* pos, uint64_t value) {
+    while (value >= 0x80) {
+        *pos++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *pos++ = static_cast<char>(value);
+    return pos;
+}
+
+// Read a LEB128 value at data[i]; false if it is truncated or longer than 64 bits
+bool readVarint(const char* data, size_t size, size_t& i, uint64_t& value) {
+    value = 0;
+    for (unsigned int shift = 0; shift < 64 && i < size; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(data[i++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Encode data[0..size) into `out` (at least varintRleBound(size) bytes); returns bytes written
+size_t compressVarintRleChunk(const char* data, size_t size, char* out) {
+    const RleKernels& kernels = rleKernels();
+    char* pos = out;
+    size_t i = 0;
+    while (i < size) {
+        // Extend the literal stretch past runs too short to be worth a run token
+        size_t literalStart = i;
+        size_t run = 0;
+        while (i < size) {
+            i += kernels.literalLength(data + i, size - i);
+            if (i >= size) break;
+            run = kernels.runLength(data + i, size - i);
+            if (run >= varintMinRun) break;
+            i += run;
+            run = 0;
+        }
+
+        if (i > literalStart) {
+            pos = writeVarint(pos, static_cast<uint64_t>(i - literalStart - 1) << 1);
+            std::memcpy(pos, data + literalStart, i - literalStart);
+            pos += i - literalStart;
+        }
+        if (run >= varintMinRun) {
+            pos = writeVarint(pos, (static_cast<uint64_t>(run - varintMinRun) << 1) | 1);
+            *pos++ = data[i];
+            i += run;
+        }
+    }
+    return static_cast<size_t>(pos - out);
+}
+
+// Decode a varint RLE chunk into exactly outSize bytes
+bool decompressVarintRleChunk(const char* data, size_t size, char* out, size_t outSize) {
+    size_t i = 0, pos = 0;
+    while (i < size) {
+        uint64_t control;
+        if (!readVarint(data, size, i, control)) return false;
+        uint64_t n = control >> 1;
+        if (control & 1) {
+            n += varintMinRun;
+            if (i >= size || n > outSize - pos) return false;
+            std::memset(out + pos, data[i++], static_cast<size_t>(n));
+        } else {
+            n += 1;
+            if (n > size - i || n > outSize - pos) return false;
+            std::memcpy(out + pos, data + i, static_cast<size_t>(n));
+            i += static_cast<size_t>(n);
+        }
+        pos += static_cast<size_t>(n);
+    }
+    return pos == outSize;
+}
+
+// Run-length pairs over wider symbols for 16- and 32-bit sample data, where two
+// equal samples such as 0x1234 0x1234 contain no byte-level run. Each pair is a
+// Symbol followed by a little-endian Count; the size % sizeof(Symbol) trailing
+// bytes of the chunk follow the pairs verbatim. The width and the run cap are
+// template parameters, so each variant compiles to its own fixed-stride loop.
+template <typename Symbol, typename Count>
+struct SymbolRunFormat {
+    typedef Count CountType;
+    static constexpr size_t symbolBytes = sizeof(Symbol);
+    static constexpr size_t pairBytes = sizeof(Symbol) + sizeof(Count);
+    static constexpr size_t maxRun = static_cast<Count>(~Count(0));
+
+    static Symbol load(const char* p) {
+        Symbol value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static size_t bound(size_t size) { return size / symbolBytes * pairBytes + symbolBytes; }
+};
+
+// Output sink writing pairs straight into a buffer of at least the format's bound
+struct PointerSink {
+    char* pos;
+
+    template <typename Format, typename Symbol>
+    void pair(Symbol symbol, size_t count) {
+        std::memcpy(pos, &symbol, sizeof(symbol));
+        putLE(pos + sizeof(symbol), static_cast<typename Format::CountType>(count));
+        pos += Format::pairBytes;
+    }
+
+    void bytes(const char* data, size_t size) {
+        std::memcpy(pos, data, size);
+        pos += size;
+    }
+};
+
+template <typename Symbol, typename Count, typename Sink>
+void encodeSymbolRuns(const char* data, size_t size, Sink& sink) {
+    typedef SymbolRunFormat<Symbol, Count> Format;
+    size_t symbols = size / Format::symbolBytes;
+    size_t i = 0;
+    while (i < symbols) {
+        Symbol symbol = Format::load(data + i * Format::symbolBytes);
+        size_t limit = std::min(symbols - i, Format::maxRun);
+        size_t run = 1;
+        while (run < limit && Format::load(data + (i + run) * Format::symbolBytes) == symbol) run++;
+        sink.template pair<Format>(symbol, run);
+        i += run;
+    }
+    sink.bytes(data + symbols * Format::symbolBytes, size - symbols * Format::symbolBytes);
+}
+
+template <typename Symbol, typename Count>
+bool decodeSymbolRuns(const char* data, size_t size, char* out, size_t outSize) {
+    typedef SymbolRunFormat<Symbol, Count> Format;
+    size_t tail = outSize % Format::symbolBytes;
+    if (size < tail || (size - tail) % Format::pairBytes != 0) return false;
+    size_t pairsEnd = size - tail;
+    size_t pos = 0;
+    for (size_t i = 0; i < pairsEnd; i += Format::pairBytes) {
+        Symbol symbol = Format::load(data + i);
+        size_t count = getLE<Count>(data + i + Format::symbolBytes);
+        if (count == 0 || count > (outSize - tail - pos) / Format::symbolBytes) return false;
+        for (size_t k = 0; k < count; k++, pos += Format::symbolBytes)
+            std::memcpy(out + pos, &symbol, sizeof(symbol));
+    }
+    if (pos != outSize - tail) return false;
+    std::memcpy(out + pos, data + pairsEnd, tail);
+    return true;
+}
+
+// Registry adapters for the variants in use: 16- and 32-bit samples, runs up to 65535
+template <typename Symbol, typename Count>
+size_t symbolRunBound(size_t size) { return SymbolRunFormat<Symbol, Count>::bound(size); }
+
+template <typename Symbol, typename Count>
+size_t compressSymbolRunChunk(const char* data, size_t size, char* out) {
+    PointerSink sink{out};
+    encodeSymbolRuns<Symbol, Count>(data, size, sink);
+    return static_cast<size_t>(sink.pos - out);
+}
+
+// Sample width of a codec, for chunk boundaries that must not split a sample
+size_t symbolWidthOf(uint8_t method) {
+    if (method == MethodRle16) return 2;
+    if (method == MethodRle32) return 4;
+    return 1;
+}
+
+// LZ77 codec in the LZ4 style. Each sequence is a token byte (literal count in the
+// high nibble, match length - 4 in the low nibble, 15 meaning "more length bytes
+// follow", each adding up to 255), the literals, then a 2-byte little-endian
+// offset into the previous 64 KiB and any extra match length bytes. The final
+// sequence carries literals only.
+const size_t lz77MinMatch = 4;
+const size_t lz77MaxOffset = 65535;
+unsigned int lz77HashBits = 14;  // match finder table size; larger finds more matches
+
+size_t lz77Bound(size_t size) { return size + size / 255 + 16; }
+
+uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Append a length that did not fit in its 4-bit token field
+char* writeLz77Length(char* pos, size_t extra) {
+    while (extra >= 255) {
+        *pos++ = static_cast<char>(255);
+        extra -= 255;
+    }
+    *pos++ = static_cast<char>(extra);
+    return pos;
+}
+
+char* writeLz77Sequence(char* pos, const char* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    char* token = pos++;
+    size_t matchCode = matchLength ? matchLength - lz77MinMatch : 0;
+    *token = static_cast<char>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+    if (literalCount >= 15) pos = writeLz77Length(pos, literalCount - 15);
+    std::memcpy(pos, literals, literalCount);
+    pos += literalCount;
+    if (matchLength == 0) return pos;
+    putLE<uint16_t>(pos, static_cast<uint16_t>(offset));
+    pos += 2;
+    if (matchCode >= 15) pos = writeLz77Length(pos, matchCode - 15);
+    return pos;
+}
+
+// Encode data[0..size) into `out` (at least lz77Bound(size) bytes); returns bytes written
+size_t compressLz77Chunk(const char* data, size_t size, char* out) {
+    thread_local std::vector<uint32_t> table;
+    table.assign(size_t(1) << lz77HashBits, 0);  // stores position + 1; 0 means empty
+
+    char* pos = out;
+    size_t anchor = 0, i = 0;
+    // The last bytes are always literals so the 4-byte probes never run off the end
+    size_t matchLimit = size > 8 ? size - 8 : 0;
+    while (i < matchLimit) {
+        uint32_t h = (read32(data + i) * 2654435761u) >> (32 - lz77HashBits);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(i + 1);
+        if (candidate == 0 || i - (candidate - 1) > lz77MaxOffset || read32(data + candidate - 1) != read32(data + i)) {
+            i++;
+            continue;
+        }
+        candidate--;
+
+        size_t length = lz77MinMatch;
+        while (i + length < size && data[candidate + length] == data[i + length]) length++;
+        pos = writeLz77Sequence(pos, data + anchor, i - anchor, i - candidate, length);
+        i += length;
+        anchor = i;
+    }
+    pos = writeLz77Sequence(pos, data + anchor, size - anchor, 0, 0);
+    return static_cast<size_t>(pos - out);
+}
+
+// Read a 4-bit length field plus its extension bytes; false if the input ends early
+bool readLz77Length(const char* data, size_t size, size_t& i, size_t& length) {
+    if (length != 15) return true;
+    while (true) {
+        if (i >= size) return false;
+        unsigned char extra = static_cast<unsigned char>(data[i++]);
+        length += extra;
+        if (extra != 255) return true;
+    }
+}
+
+// Decode an LZ77 chunk into exactly outSize bytes
+bool decompressLz77Chunk(const char* data, size_t size, char* out, size_t outSize) {
+    size_t i = 0, pos = 0;
+    while (i < size) {
+        unsigned char token = static_cast<unsigned char>(data[i++]);
+        size_t literalCount = token >> 4;
+        if (!readLz77Length(data, size, i, literalCount)) return false;
+        if (literalCount > size - i || literalCount > outSize - pos) return false;
+        std::memcpy(out + pos, data + i, literalCount);
+        i += literalCount;
+        pos += literalCount;
+        if (i == size) break;
+
+        if (size - i < 2) return false;
+        size_t offset = getLE<uint16_t>(data + i);
+        i += 2;
+        size_t length = token & 15;
+        if (!readLz77Length(data, size, i, length)) return false;
+        length += lz77MinMatch;
+        if (offset == 0 || offset > pos || length > outSize - pos) return false;
+
+        // Overlapping matches (offset < length) repeat the window byte by byte
+        if (offset >= length) {
+            std::memcpy(out + pos, out + pos - offset, length);
+        } else {
+            for (size_t k = 0; k < length; k++) out[pos + k] = out[pos + k - offset];
+        }
+        pos += length;
+    }
+    return pos == outSize;
+}
+
+// Adapters giving every codec the same shape
+size_t storedBound(size_t) { return 0; }
+size_t compressStoredChunk(const char*, size_t, char*) { return 0; }  // payload is the input itself
+bool decompressStoredChunk(const char* data, size_t size, char* out, size_t outSize) {
+    if (size != outSize) return false;
+    std::memcpy(out, data, size);
+    return true;
+}
+size_t compressRlePairsChunk(const char* data, size_t size, char* out) {
+    return compressRLEChunk(data, 0, size, out, rleBound(size));
+}
+
+// A chunk codec. encode() is always given bound(size) bytes of output and returns
+// the encoded size; decode() must expand to exactly outSize bytes or fail.
+struct Codec {
+    uint8_t id;
+    const char* name;
+    size_t (*bound)(size_t size);
+    size_t (*encode)(const char* data, size_t size, char* out);
+    bool (*decode)(const char* data, size_t size, char* out, size_t outSize);
+};
+
+// All codecs, indexed by the ID stored in the header and in each chunk entry
+const Codec codecs[] = {
+    {MethodRlePairs, "rle", rleBound, compressRlePairsChunk, decompressRLEChunk},
+    {MethodStored, "stored", storedBound, compressStoredChunk, decompressStoredChunk},
+    {MethodPackBits, "packbits", packBitsBound, compressPackBitsChunk, decompressPackBitsChunk},
+    {MethodLz77, "lz77", lz77Bound, compressLz77Chunk, decompressLz77Chunk},
+    {MethodVarintRle, "varint", varintRleBound, compressVarintRleChunk, decompressVarintRleChunk},
+    {MethodRle16, "rle16", symbolRunBound<uint16_t, uint16_t>, compressSymbolRunChunk<uint16_t, uint16_t>,
+     decodeSymbolRuns<uint16_t, uint16_t>},
+    {MethodRle32, "rle32", symbolRunBound<uint32_t, uint16_t>, compressSymbolRunChunk<uint32_t, uint16_t>,
+     decodeSymbolRuns<uint32_t, uint16_t>},
+};
+
+const Codec* findCodec(uint8_t id) {
+    for (const Codec& codec : codecs)
+        if (codec.id == id) return &codec;
+    return nullptr;
+}
+
+const Codec* findCodec(const std::string& name) {
+    for (const Codec& codec : codecs)
+        if (name == codec.name) return &codec;
+    return nullptr;
+}
+
+// Codec new chunks are encoded with. In adaptive mode every codec in
+// adaptiveCodecs is tried per chunk (cheapest first) and the smallest output kept,
+// until the chunk's time budget of adaptiveBudgetNsPerByte runs out (0 = no limit).
+uint8_t selectedCodec = MethodVarintRle;
+std::vector<uint8_t> adaptiveCodecs;
+double adaptiveBudgetNsPerByte = 0;
+
+// Compression presets -1..-9, trading throughput for ratio
+struct CompressionPreset {
+    uint8_t codec;
+    std::vector<uint8_t> adaptive;  // empty: codec only
+    double budgetNsPerByte;
+    unsigned int lz77HashBits;
+};
+
+const CompressionPreset presets[9] = {
+    {MethodRlePairs, {}, 0, 14},
+    {MethodVarintRle, {}, 0, 14},
+    {MethodVarintRle, {MethodVarintRle, MethodPackBits}, 10, 14},
+    {MethodLz77, {}, 0, 12},
+    {MethodLz77, {}, 0, 14},
+    {MethodLz77, {}, 0, 16},
+    {MethodVarintRle, {MethodVarintRle, MethodPackBits, MethodLz77}, 20, 16},
+    {MethodVarintRle, {MethodVarintRle, MethodPackBits, MethodLz77}, 50, 16},
+    {MethodVarintRle, {MethodVarintRle, MethodPackBits, MethodLz77}, 0, 16},
+};
+const int defaultLevel = 2;
+
+void applyPreset(int level) {
+    const CompressionPreset& preset = presets[level - 1];
+    selectedCodec = preset.codec;
+    adaptiveCodecs = preset.adaptive;
+    adaptiveBudgetNsPerByte = preset.budgetNsPerByte;
+    lz77HashBits = preset.lz77HashBits;
+}
+
+// Worst-case encoded size of a chunk before the stored fallback kicks in
+size_t chunkBound(size_t size) {
+    size_t bound = findCodec(selectedCodec)->bound(size);
+    for (uint8_t id : adaptiveCodecs)
+        bound = std::max(bound, findCodec(id)->bound(size));
+    return bound;
+}
+
+// Estimated compressibility of a chunk from a handful of evenly spaced windows
+struct CompressibilitySample {
+    double runFraction = 1.0;  // share of sampled bytes inside runs of packBitsMinRun or more
+    double entropyBits = 0.0;  // order-0 entropy of the sampled bytes, in bits per byte
+};
+
+const size_t sampleWindows = 16;
+const size_t sampleWindowSize = 512;
+const size_t sampleMinChunk = 64u << 10;  // smaller chunks are cheaper to just encode
+const double sampleMinRunFraction = 1.0 / 64;
+const double sampleMaxEntropyBits = 7.8;
+
+// Skip the encoder for chunks the sampler predicts will not shrink
+bool useSampling = true;
+
+CompressibilitySample sampleChunk(const char* data, size_t size) {
+    CompressibilitySample sample;
+    if (size < sampleWindows * sampleWindowSize) return sample;
+
+    const RleKernels& kernels = rleKernels();
+    size_t histogram[256] = {};
+    size_t sampled = 0, runBytes = 0;
+    size_t stride = size / sampleWindows;
+    for (size_t w = 0; w < sampleWindows; w++) {
+        const char* window = data + w * stride;
+        for (size_t i = 0; i < sampleWindowSize; ) {
+            size_t literal = kernels.literalLength(window + i, sampleWindowSize - i);
+            i += literal;
+            if (i >= sampleWindowSize) break;
+            size_t run = kernels.runLength(window + i, sampleWindowSize - i);
+            if (run >= packBitsMinRun) runBytes += run;
+            i += run;
+        }
+        for (size_t i = 0; i < sampleWindowSize; i++)
+            histogram[static_cast<unsigned char>(window[i])]++;
+        sampled += sampleWindowSize;
+    }
+
+    sample.runFraction = static_cast<double>(runBytes) / sampled;
+    for (size_t count : histogram) {
+        if (count == 0) continue;
+        double p = static_cast<double>(count) / sampled;
+        sample.entropyBits -= p * std::log2(p);
+    }
+    return sample;
+}
+
+// Whether the sampler rules a codec out for a chunk: run-based codecs need runs,
+// LZ77 needs a skewed byte distribution. Byte runs say nothing about sample runs,
+// so the wide-symbol codecs are never ruled out.
+bool sampleRulesOut(uint8_t codec, const CompressibilitySample& sample) {
+    if (codec == MethodLz77) return sample.entropyBits > sampleMaxEntropyBits;
+    if (symbolWidthOf(codec) > 1) return false;
+    return sample.runFraction < sampleMinRunFraction;
+}
+
+// Encode one chunk into `out` (at least chunkBound(size) bytes). When encoding does
+// not shrink the chunk it is stored instead: nothing is written and the caller
+// emits the original bytes, so a chunk never grows beyond its raw size.
+ChunkMethod encodeChunk(const char* data, size_t size, char* out, size_t& encodedSize) {
+    WorkTimer work(size);
+    const std::vector<uint8_t> single(1, selectedCodec);
+    const std::vector<uint8_t>& candidates = adaptiveCodecs.empty() ? single : adaptiveCodecs;
+    encodedSize = size;
+    if (candidates.size() == 1 && candidates[0] == MethodStored) return MethodStored;
+
+    // Chunks the sampler rules out for every candidate go straight to stored mode
+    if (useSampling && size >= sampleMinChunk) {
+        CompressibilitySample sample = sampleChunk(data, size);
+        bool hopeless = true;
+        for (uint8_t id : candidates)
+            hopeless = hopeless && sampleRulesOut(id, sample);
+        if (hopeless) return MethodStored;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    double budgetNs = adaptiveBudgetNsPerByte * static_cast<double>(size);
+    ChunkMethod best = MethodStored;
+    thread_local std::vector<char> scratch;
+
+    for (size_t c = 0; c < candidates.size(); c++) {
+        const Codec& codec = *findCodec(candidates[c]);
+        if (codec.id == MethodStored) continue;
+        if (c > 0 && budgetNs > 0) {
+            double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+            if (elapsed > budgetNs) break;
+        }
+
+        // The first candidate encodes in place; later ones only replace it when smaller
+        size_t candidateSize;
+        if (best == MethodStored) {
+            candidateSize = codec.encode(data, size, out);
+        } else {
+            scratch.resize(codec.bound(size));
+            candidateSize = codec.encode(data, size, scratch.data());
+            if (candidateSize < encodedSize) std::memcpy(out, scratch.data(), candidateSize);
+        }
+        if (candidateSize < encodedSize) {
+            encodedSize = candidateSize;
+            best = static_cast<ChunkMethod>(codec.id);
+        }
+    }
+
+    // Long runs cost two bytes per 130 in PackBits but per 255 as plain pairs, so
+    // run-dominated chunks also try pairs, bounded by the PackBits size
+    if (candidates.size() == 1 && best == MethodPackBits && encodedSize * 4 < size) {
+        scratch.resize(encodedSize);
+        size_t pairsSize = compressRLEChunk(data, 0, size, scratch.data(), scratch.size());
+        if (pairsSize < encodedSize) {
+            std::memcpy(out, scratch.data(), pairsSize);
+            encodedSize = pairsSize;
+            best = MethodRlePairs;
+        }
+    }
+
+    if (best == MethodStored) encodedSize = size;
+    return best;
+}
+
+// Chunk sizing for in-memory inputs: several chunks per worker so the pool can
+// balance uneven chunks, clamped so small files are not over-split and large files
+// keep chunks cache-sized whatever the core count
+const size_t minChunkSize = 64u << 10;
+const size_t maxChunkSize = 4u << 20;
+const size_t chunksPerThread = 4;
+const size_t maxBoundaryShift = 4096;
+
+// Move a chunk boundary forward to the end of the run it falls inside, so the run
+// is not split into two tokens; runs longer than maxBoundaryShift are still cut.
+// Wide-symbol codecs keep the caller's boundary, which is a multiple of the sample size.
+size_t alignToRunEnd(const char* data, size_t size, size_t boundary) {
+    if (symbolWidthOf(selectedCodec) > 1) return boundary;
+    if (boundary == 0 || boundary >= size || data[boundary - 1] != data[boundary]) return boundary;
+    return boundary + rleKernels().runLength(data + boundary, std::min(size - boundary, maxBoundaryShift));
+}
+
+// Chunk boundaries for an input: 0, ..., size
+std::vector<size_t> planChunks(const char* data, size_t size, unsigned int numThreads) {
+    size_t target = size / (static_cast<size_t>(numThreads) * chunksPerThread) + 1;
+    target = std::min(std::max(target, minChunkSize), maxChunkSize);
+    target -= target % symbolWidthOf(selectedCodec);
+
+    std::vector<size_t> boundaries(1, 0);
+    size_t pos = 0;
+    while (pos < size) {
+        size_t next = pos + target;
+        // Fold a short tail into the last chunk instead of creating a sliver
+        if (next >= size || size - next < minChunkSize / 4) next = size;
+        else next = alignToRunEnd(data, size, next);
+        boundaries.push_back(next);
+        pos = next;
+    }
+    return boundaries;
+}
+
+// Decode one chunk payload with the codec named by its method into exactly outSize bytes
+bool decodeChunk(uint8_t method, const char* data, size_t size, char* out, size_t outSize) {
+    WorkTimer work(outSize);
+    const Codec* codec = findCodec(method);
+    return codec && codec->decode(data, size, out, outSize);
+}
+
+// Outcome of decoding one chunk. Workers record it per chunk and the thread that
+// merges the results reports failures, so workers never contend for the console.
+enum ChunkStatus : uint8_t { ChunkOk, ChunkReadFailed, ChunkUnknownMethod, ChunkMalformed, ChunkChecksumMismatch };
+
+const char* chunkStatusText(ChunkStatus status) {
+    switch (status) {
+    case ChunkOk: return "ok";
+    case ChunkReadFailed: return "could not be read";
+    case ChunkUnknownMethod: return "uses an unknown codec";
+    case ChunkMalformed: return "is malformed (payload does not decode to its recorded size)";
+    case ChunkChecksumMismatch: return "fails its checksum";
+    }
+    return "is corrupt";
+}
+
+// Checksum kind recorded in container (or framed stream) header flags
+ChecksumType checksumTypeOf(uint8_t flags) {
+    return (flags & containerFlagCrc32c) ? ChecksumCrc32c : ChecksumFnv1a;
+}
+
+// Decode one container chunk into out[0..entry.decompressedLength) and verify it
+ChunkStatus decodeVerifiedChunk(const ChunkEntry& entry, const char* payload, char* out, ChecksumType checksum) {
+    if (!findCodec(entry.method)) return ChunkUnknownMethod;
+    if (!decodeChunk(entry.method, payload, entry.compressedLength, out, entry.decompressedLength))
+        return ChunkMalformed;
+    if (chunkChecksum(out, entry.decompressedLength, checksum) != entry.checksum) return ChunkChecksumMismatch;
+    return ChunkOk;
+}
+
+// Recycled page-aligned blocks for chunk slabs, decode outputs and I/O slots.
+// Blocks come in power-of-two size classes; each thread keeps a few per class and
+// hands the rest to a shared list, so steady batch work stops going back to the
+// allocator and faulting in fresh pages. Blocks of 2 MiB and up ask for huge pages.
+class BufferPool {
+public:
+    static const unsigned minClassBits = 16;
+    static const unsigned classCount = 32;
+    static const size_t threadCacheDepth = 2;
+    static const size_t sharedRetainLimit = 256u << 20;
+
+    // A block of at least `size` bytes; `capacity` receives its real size and `node`
+    // the NUMA node whose shared list it must go back to. Shared blocks come from
+    // the caller's node, and fresh ones are first touched by the caller.
+    char* acquire(size_t size, size_t& capacity, unsigned int& node) {
+        unsigned sizeClass = classFor(size);
+        capacity = size_t(1) << (minClassBits + sizeClass);
+        node = currentNumaNode;
+        std::vector<char*>& local = threadCache().lists[sizeClass];
+        if (!local.empty()) {
+            char* block = local.back();
+            local.pop_back();
+            return block;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m);
+            std::vector<char*>& list = shared[node][sizeClass];
+            if (!list.empty()) {
+                char* block = list.back();
+                list.pop_back();
+                retained -= capacity;
+                return block;
+            }
+        }
+        return mapBlock(capacity);
+    }
+
+    // Blocks from another node skip the thread cache so they are not reused there
+    void release(char* block, size_t capacity, unsigned int node) {
+        unsigned sizeClass = classFor(capacity);
+        std::vector<char*>& local = threadCache().lists[sizeClass];
+        if (node == currentNumaNode && local.size() < threadCacheDepth) {
+            local.push_back(block);
+            return;
+        }
+        releaseShared(block, capacity, node);
+    }
+
+private:
+    // Per-thread free lists, flushed to the shared lists when the thread exits
+    struct ThreadCache {
+        BufferPool* owner;
+        std::vector<char*> lists[classCount];
+        explicit ThreadCache(BufferPool* pool) : owner(pool) {}
+        ~ThreadCache() {
+            for (unsigned c = 0; c < classCount; c++)
+                for (char* block : lists[c]) owner->releaseShared(block, size_t(1) << (minClassBits + c), currentNumaNode);
+        }
+    };
+
+    ThreadCache& threadCache() {
+        thread_local ThreadCache cache(this);
+        return cache;
+    }
+
+    static unsigned classFor(size_t size) {
+        unsigned sizeClass = 0;
+        while ((size_t(1) << (minClassBits + sizeClass)) < size) sizeClass++;
+        return sizeClass;
+    }
+
+    void releaseShared(char* block, size_t capacity, unsigned int node) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (retained + capacity <= sharedRetainLimit) {
+                shared[node][classFor(capacity)].push_back(block);
+                retained += capacity;
+                return;
+            }
+        }
+        unmapBlock(block, capacity);
+    }
+
+    static char* mapBlock(size_t capacity) {
+#ifdef HAVE_MMAP
+        void* block = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        if (capacity >= (2u << 20)) madvise(block, capacity, MADV_HUGEPAGE);
+#endif
+#else
+        void* block = std::aligned_alloc(4096, capacity);
+        if (!block) throw std::bad_alloc();
+#endif
+        return static_cast<char*>(block);
+    }
+
+    static void unmapBlock(char* block, size_t capacity) {
+#ifdef HAVE_MMAP
+        munmap(block, capacity);
+#else
+        (void)capacity;
+        std::free(block);
+#endif
+    }
+
+    std::mutex m;
+    std::vector<char*> shared[maxNumaNodes][classCount];
+    size_t retained = 0;
+};
+
+// Process-wide pool; never destroyed, so thread caches can flush into it at any exit
+BufferPool& bufferPool() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+// Uninitialised output buffer for data that is about to be overwritten in full,
+// so large outputs are not zero-filled before decoding. Storage comes from the
+// buffer pool and goes back to it when the buffer is reset or destroyed.
+class ByteBuffer {
+public:
+    ByteBuffer() = default;
+    ByteBuffer(const ByteBuffer&) = delete;
+    ByteBuffer& operator=(const ByteBuffer&) = delete;
+    ByteBuffer(ByteBuffer&& other) noexcept { *this = std::move(other); }
+
+    ByteBuffer& operator=(ByteBuffer&& other) noexcept {
+        if (this == &other) return *this;
+        reset();
+        bytes = other.bytes;
+        capacity = other.capacity;
+        length = other.length;
+        node = other.node;
+        other.bytes = nullptr;
+        other.capacity = other.length = 0;
+        return *this;
+    }
+
+    ~ByteBuffer() { reset(); }
+
+    void allocate(size_t size) {
+        if (!bytes || capacity < size) {
+            reset();
+            bytes = bufferPool().acquire(size > 0 ? size : 1, capacity, node);
+        }
+        length = size;
+    }
+
+    void reset() {
+        if (bytes) bufferPool().release(bytes, capacity, node);
+        bytes = nullptr;
+        capacity = length = 0;
+    }
+
+    char* data() { return bytes; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    char* bytes = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+    unsigned int node = 0;
+};
+
+// Leave holes for all-zero blocks in decompressed output files (--sparse)
+bool sparseOutput = false;
+
+// Holes are created at this granularity, the usual filesystem block size, aligned
+// to the file offset so a hole always covers whole blocks
+const size_t sparseBlockSize = 4096;
+
+bool isZeroBlock(const char* data, size_t size) {
+    return size > 0 && data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0;
+}
+
+// Output file that skips all-zero blocks instead of writing them. The file is
+// truncated on open, so a skipped range reads back as zeros without a punch-hole,
+// and close() sets the final length in case the data ends inside a hole. Without
+// POSIX file calls it writes every byte through an ofstream.
+class SparseFileBuffer : public std::streambuf {
+public:
+    ~SparseFileBuffer() { close(); }
+
+    bool open(const std::string& filename) {
+#ifdef HAVE_MMAP
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        failed = fd < 0;
+#else
+        file.open(filename, std::ios::binary);
+        failed = !file;
+#endif
+        return !failed;
+    }
+
+    bool close() {
+#ifdef HAVE_MMAP
+        if (fd < 0) return !failed;
+        if (ftruncate(fd, static_cast<off_t>(offset)) != 0) failed = true;
+        if (::close(fd) != 0) failed = true;
+        fd = -1;
+#else
+        if (file.is_open()) {
+            file.close();
+            if (!file) failed = true;
+        }
+#endif
+        return !failed;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        char byte = traits_type::to_char_type(c);
+        return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        return append(data, static_cast<size_t>(count)) ? count : 0;
+    }
+
+private:
+    bool append(const char* data, size_t size) {
+        if (failed) return false;
+#ifdef HAVE_MMAP
+        // Only whole aligned zero blocks become holes; everything between them is
+        // gathered and written with one pwrite
+        size_t i = 0, pending = 0;
+        while (i < size) {
+            size_t block = std::min(size - i, sparseBlockSize - static_cast<size_t>((offset + pending) % sparseBlockSize));
+            if (block < sparseBlockSize || !isZeroBlock(data + i, block)) {
+                pending += block;
+                i += block;
+                continue;
+            }
+            if (pending > 0 && !writeAt(data + i - pending, pending)) return false;
+            pending = 0;
+            offset += block;
+            i += block;
+        }
+        if (pending > 0 && !writeAt(data + size - pending, pending)) return false;
+        return true;
+#else
+        file.write(data, static_cast<std::streamsize>(size));
+        offset += size;
+        failed = !file;
+        return !failed;
+#endif
+    }
+
+#ifdef HAVE_MMAP
+    bool writeAt(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) {
+                failed = true;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+        return true;
+    }
+
+    int fd = -1;
+#else
+    std::ofstream file;
+#endif
+    uint64_t offset = 0;
+    bool failed = false;
+};
+
+// Destination for decompressed data: stdout for "-", otherwise a SparseFileBuffer
+// when sparseOutput is set or an ordinary ofstream
+// Output files are written under a temporary name and renamed into place once
+// complete, so an interrupted run never leaves a file that looks finished
+std::string partialPath(const std::string& path) { return path + ".part"; }
+
+// Make a finished temporary output durable and move it to its final name
+bool commitPartial(const std::string& path) {
+#ifdef HAVE_MMAP
+    int fd = open(partialPath(path).c_str(), O_RDONLY | O_CLOEXEC);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    if (!synced) return false;
+#endif
+    std::error_code error;
+    std::filesystem::rename(partialPath(path), path, error);
+    return !error;
+}
+
+class DecodedFile {
+public:
+    explicit DecodedFile(const std::string& filename) : sparseStream(&sparse) {
+        if (filename == "-") {
+            out = &std::cout;
+            return;
+        }
+        target = filename;
+        if (sparseOutput) {
+            if (!sparse.open(partialPath(target))) sparseStream.setstate(std::ios::badbit);
+            out = &sparseStream;
+        } else {
+            file.open(partialPath(target), std::ios::binary);
+            out = &file;
+        }
+    }
+
+    // A file that was never closed successfully is not left behind
+    ~DecodedFile() {
+        if (!target.empty() && !committed) std::remove(partialPath(target).c_str());
+    }
+
+    std::ostream& stream() { return *out; }
+
+    // The name actually being written, for error messages
+    std::string path() const { return target.empty() ? "-" : partialPath(target); }
+
+    // Flush everything, set the final length of sparse files and rename the
+    // finished file into place
+    bool close() {
+        if (!out->flush()) return false;
+        if (out == &sparseStream && !sparse.close()) return false;
+        if (out == &file) file.close();
+        if (!*out) return false;
+        if (target.empty()) return true;
+        committed = commitPartial(target);
+        return committed;
+    }
+
+private:
+    std::string target;
+    bool committed = false;
+    std::ofstream file;
+    SparseFileBuffer sparse;
+    std::ostream sparseStream;
+    std::ostream* out = nullptr;
+};
+
+// A contiguous piece of an output file
+struct OutputSegment {
+    const char* data;
+    size_t size;
+};
+
+// Copy src[0..size) to dst with one pool task per worker for large copies
+void parallelCopy(char* dst, const char* src, size_t size) {
+    size_t pieces = (size < smallInputThreshold) ? 1 : threadPool().size();
+    parallelFor(pieces, [&](size_t p) {
+        size_t begin = size * p / pieces, end = size * (p + 1) / pieces;
+        std::memcpy(dst + begin, src + begin, end - begin);
+    }, size);
+}
+
+#ifdef HAVE_MMAP
+// Outputs at least this large are written by all pool workers at once. Buffered
+// write() calls on one file serialise on its inode lock, so the file is sized,
+// mapped shared, and each worker copies one byte range of the segments into place,
+// finding its first segment in a prefix sum of the segment sizes. The blocks are
+// reserved first, so a full disk is an error here rather than a SIGBUS on a store.
+// Faulting in shared pages costs a core more than a plain write(), so it only
+// pays off with several workers copying.
+const size_t parallelWriteThreshold = 8u << 20;
+const unsigned int parallelWriteMinWorkers = 4;
+
+// Returns false without touching the file when blocks cannot be reserved, so the
+// caller can fall back to writev()
+bool writeSegmentsMapped(int fd, const std::vector<OutputSegment>& segments, size_t total, bool& failed) {
+    failed = false;
+#if defined(__linux__)
+    if (fallocate(fd, 0, 0, static_cast<off_t>(total)) != 0) return false;
+#elif defined(__APPLE__)
+    // No posix_fallocate(), and ftruncate() alone reserves nothing, so a full
+    // disk would only show up as SIGBUS: use writev() instead
+    return false;
+#else
+    if (posix_fallocate(fd, 0, static_cast<off_t>(total)) != 0) return false;
+#endif
+    void* mapped = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        failed = ftruncate(fd, 0) != 0;
+        return false;
+    }
+    char* out = static_cast<char*>(mapped);
+
+    std::vector<size_t> starts(segments.size() + 1, 0);
+    for (size_t i = 0; i < segments.size(); i++) starts[i + 1] = starts[i] + segments[i].size;
+
+    size_t pieces = threadPool().size();
+    parallelFor(pieces, [&](size_t p) {
+        size_t begin = total * p / pieces, end = total * (p + 1) / pieces;
+        size_t s = static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), begin) - starts.begin()) - 1;
+        for (; s < segments.size() && starts[s] < end; s++) {
+            size_t from = std::max(begin, starts[s]), to = std::min(end, starts[s + 1]);
+            if (to > from) std::memcpy(out + from, segments[s].data + (from - starts[s]), to - from);
+        }
+    }, total);
+    failed = munmap(mapped, total) != 0;
+    return true;
+}
+#endif
+
+// Write a list of segments to a file with gathered writes, so pieces already in
+// memory are never merged into a single buffer first. With `sparse`, zero blocks
+// become holes through a SparseFileBuffer instead.
+bool writeSegmentsTo(const std::string& filename, const std::vector<OutputSegment>& segments, bool sparse) {
+    if (sparse) {
+        SparseFileBuffer file;
+        if (!file.open(filename)) return false;
+        std::ostream out(&file);
+        for (const auto& segment : segments)
+            out.write(segment.data, static_cast<std::streamsize>(segment.size));
+        return static_cast<bool>(out) && file.close();
+    }
+#ifdef HAVE_MMAP
+    size_t total = 0;
+    for (const auto& segment : segments) total += segment.size;
+    bool parallel = total >= parallelWriteThreshold && threadPool().size() >= parallelWriteMinWorkers;
+    // The shared mapping needs read access to the file as well
+    int fd = open(filename.c_str(), (parallel ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool failed = false;
+    if (parallel && writeSegmentsMapped(fd, segments, total, failed)) return (close(fd) == 0) && !failed;
+    if (failed) {
+        close(fd);
+        return false;
+    }
+
+    const size_t maxIov = 1024;
+    size_t next = 0, skip = 0;
+    while (next < segments.size()) {
+        struct iovec iov[maxIov];
+        int count = 0;
+        for (size_t i = next; i < segments.size() && count < static_cast<int>(maxIov); i++) {
+            size_t offset = (i == next) ? skip : 0;
+            iov[count].iov_base = const_cast<char*>(segments[i].data + offset);
+            iov[count].iov_len = segments[i].size - offset;
+            count++;
+        }
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) {
+            close(fd);
+            return false;
+        }
+        // Advance past everything writev accepted, which may end mid-segment
+        size_t remaining = static_cast<size_t>(written);
+        while (next < segments.size() && remaining >= segments[next].size - skip) {
+            remaining -= segments[next].size - skip;
+            next++;
+            skip = 0;
+        }
+        skip += remaining;
+    }
+    return close(fd) == 0;
+#else
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) return false;
+    for (const auto& segment : segments)
+        out.write(segment.data, segment.size);
+    return static_cast<bool>(out);
+#endif
+}
+
+// writeSegmentsTo() under the temporary name, then rename the file into place
+bool writeSegments(const std::string& filename, const std::vector<OutputSegment>& segments, bool sparse = false) {
+    StageTimer timer(StageWrite);
+    if (statsEnabled)
+        for (const auto& segment : segments) timer.addBytes(segment.size);
+    if (!writeSegmentsTo(partialPath(filename), segments, sparse) || !commitPartial(filename)) {
+        std::remove(partialPath(filename).c_str());
+        return false;
+    }
+    return true;
+}
+
+// writeSegments(), or the segments in order on stdout when filename is "-"
+bool writeOutput(const std::string& filename, const std::vector<OutputSegment>& segments, bool sparse = false) {
+    if (filename != "-") return writeSegments(filename, segments, sparse);
+    StageTimer timer(StageWrite);
+    for (const auto& segment : segments) {
+        std::cout.write(segment.data, static_cast<std::streamsize>(segment.size));
+        timer.addBytes(segment.size);
+    }
+    return static_cast<bool>(std::cout.flush());
+}
+
+// Read entire binary file into a vector<char>
+std::vector<char> readFile(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open " << filename << "\n";
+        return {};
+    }
+    in.seekg(0, std::ios::end);
+    size_t size = (size_t)in.tellg();
+    in.seekg(0, std::ios::beg);
+    std::vector<char> data(size);
+    in.read(data.data(), size);
+    return data;
+}
+
+// Read-only input bytes, owned either by a vector or by a read-only memory mapping
+class InputBuffer {
+public:
+    InputBuffer() = default;
+    explicit InputBuffer(std::vector<char> bytes)
+        : owned(std::move(bytes)), ptr(owned.data()), len(owned.size()) {}
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+    InputBuffer(InputBuffer&& other) noexcept { *this = std::move(other); }
+
+    InputBuffer& operator=(InputBuffer&& other) noexcept {
+        if (this == &other) return *this;
+        release();
+        owned = std::move(other.owned);
+        ptr = other.mapping ? other.ptr : owned.data();
+        len = other.len;
+        mapping = other.mapping;
+        other.ptr = nullptr;
+        other.len = 0;
+        other.mapping = nullptr;
+        return *this;
+    }
+
+    ~InputBuffer() { release(); }
+
+    // Adopt an existing mapping; it is unmapped when the buffer goes away
+    static InputBuffer fromMapping(void* mapping, size_t size) {
+        InputBuffer buffer;
+        buffer.mapping = mapping;
+        buffer.ptr = static_cast<const char*>(mapping);
+        buffer.len = size;
+        return buffer;
+    }
+
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+
+private:
+    void release() {
+#ifdef HAVE_MMAP
+        if (mapping) munmap(mapping, len);
+#endif
+        mapping = nullptr;
+        ptr = nullptr;
+        len = 0;
+    }
+
+    std::vector<char> owned;
+    const char* ptr = nullptr;
+    size_t len = 0;
+    void* mapping = nullptr;
+};
+
+// Use memory-mapped input files where the platform supports it
+bool useMmap = true;
+
+// Map a file read-only so workers read the page cache directly, with no kernel-to-user
+// copy and no zero-filled staging vector. Falls back to readFile() when mapping fails.
+// With `prefetch` the pages are read in before returning, so a loader thread does
+// the I/O instead of the workers faulting it in while they encode.
+InputBuffer mapFile(const std::string& filename, bool prefetch = false) {
+#ifdef HAVE_MMAP
+    if (useMmap) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Failed to open " << filename << "\n";
+            return InputBuffer();
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size_t size = static_cast<size_t>(st.st_size);
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapping != MAP_FAILED) {
+                madvise(mapping, size, MADV_SEQUENTIAL);
+                if (prefetch) {
+                    madvise(mapping, size, MADV_WILLNEED);
+                    const volatile char* bytes = static_cast<const char*>(mapping);
+                    for (size_t i = 0; i < size; i += 4096) (void)bytes[i];
+                }
+                return InputBuffer::fromMapping(mapping, size);
+            }
+        } else {
+            close(fd);
+        }
+    }
+#endif
+    return InputBuffer(readFile(filename));
+}
+
+// Size of an existing file, or -1 if it cannot be opened
+long long fileSize(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) return -1;
+    return static_cast<long long>(in.tellg());
+}
+
+// Files at least this large are compressed/decompressed through the streaming pipeline
+const size_t streamThreshold = 64u << 20;
+const size_t streamBlockSize = 1u << 20;
+
+// One block travelling through the streaming pipeline
+struct StreamBlock {
+    std::vector<char> input;
+    std::vector<char> output;
+    ChunkEntry entry;
+    bool ok = true;
+    ChunkStatus status = ChunkOk;  // why a block failed, reported by the writer stage
+    ChecksumType checksum = ChecksumCrc32c;  // how entry.checksum was computed (decoding)
+};
+
+// Bounded pipeline: a reader thread fills blocks, pool tasks transform them and the
+// calling thread writes finished blocks in input order. At most `depth` blocks are in
+// flight, so memory is bounded by depth x block size regardless of the file size.
+// readBlock returns false once the input is exhausted. writeBlock also sees failed
+// blocks (ok == false), so errors are reported in order from one thread; it returns
+// false to stop the pipeline.
+bool runBlockPipeline(size_t depth,
+                      const std::function<bool(StreamBlock&)>& readBlock,
+                      const std::function<void(StreamBlock&)>& processBlock,
+                      const std::function<bool(StreamBlock&)>& writeBlock) {
+    enum SlotState { Free, Filled, Done };
+    std::vector<StreamBlock> blocks(depth);
+    std::vector<SlotState> state(depth, Free);
+    std::mutex m;
+    std::condition_variable cv;
+    size_t readSeq = 0, writeSeq = 0;
+    bool inputDone = false, failed = false;
+    TaskGroup group(threadPool());
+
+    // Reader stage: fill the next free slot in sequence order and hand it to the pool
+    std::thread reader([&]() {
+        while (true) {
+            size_t slot;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&]() { return failed || state[readSeq % depth] == Free; });
+                if (failed) return;
+                slot = readSeq % depth;
+            }
+            bool more = readBlock(blocks[slot]);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                if (more) {
+                    state[slot] = Filled;
+                    readSeq++;
+                } else {
+                    inputDone = true;
+                }
+            }
+            if (!more) {
+                cv.notify_all();
+                return;
+            }
+            group.run([&, slot]() {
+                processBlock(blocks[slot]);
+                std::lock_guard<std::mutex> lock(m);
+                state[slot] = Done;
+                cv.notify_all();
+            });
+        }
+    });
+
+    // Writer stage: emit finished blocks strictly in sequence order
+    bool ok = true;
+    while (true) {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&]() {
+                return state[writeSeq % depth] == Done || (inputDone && writeSeq >= readSeq);
+            });
+            if (state[writeSeq % depth] != Done) break;
+            slot = writeSeq % depth;
+        }
+        bool written = writeBlock(blocks[slot]);
+        std::lock_guard<std::mutex> lock(m);
+        if (!written) {
+            ok = false;
+            failed = true;
+            cv.notify_all();
+            break;
+        }
+        state[slot] = Free;
+        writeSeq++;
+        cv.notify_all();
+    }
+
+    reader.join();
+    group.wait();
+    return ok;
+}
+
+#ifdef HAVE_IO_URING
+bool useIoUring = true;
+
+// Minimal io_uring wrapper over the raw syscalls: one submission and one completion
+// queue, driven from a single thread. Buffers registered once are reused by every
+// fixed read and write, so the kernel does not pin and unpin pages per request.
+class IoRing {
+public:
+    ~IoRing() {
+        if (sqes) munmap(sqes, sqesLength);
+        if (cqRing && cqRing != sqRing) munmap(cqRing, cqLength);
+        if (sqRing) munmap(sqRing, sqLength);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) return false;
+
+        sqLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqLength = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) sqLength = cqLength = std::max(sqLength, cqLength);
+        sqRing = mapRing(sqLength, IORING_OFF_SQ_RING);
+        if (!sqRing) return false;
+        cqRing = singleMap ? sqRing : mapRing(cqLength, IORING_OFF_CQ_RING);
+        if (!cqRing) return false;
+        sqesLength = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mapRing(sqesLength, IORING_OFF_SQES));
+        if (!sqes) return false;
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool registerBuffers(const std::vector<struct iovec>& buffers) {
+        return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+                       buffers.data(), static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    // Queue one request; false if the submission queue is full
+    bool queue(uint8_t opcode, int fd, void* addr, uint32_t length, uint64_t offset,
+               uint16_t bufferIndex, uint64_t userData) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return false;
+        unsigned index = tail & sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(addr);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.buf_index = bufferIndex;
+        sqe.user_data = userData;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+        return true;
+    }
+
+    // Submit everything queued and block until at least one completion is available
+    bool submitAndWait() {
+        while (true) {
+            long submitted = syscall(__NR_io_uring_enter, ringFd, unsubmitted, 1,
+                                     IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0) {
+                unsubmitted -= static_cast<unsigned>(submitted);
+                return true;
+            }
+            if (errno != EINTR) return false;
+        }
+    }
+
+    bool nextCompletion(uint64_t& userData, int& result) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+        const io_uring_cqe& cqe = cqes[head & cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    void* mapRing(size_t length, off_t offset) {
+        void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqLength = 0, cqLength = 0, sqesLength = 0;
+    unsigned *sqHead = nullptr, *sqTail = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr;
+    unsigned sqMask = 0, cqMask = 0, sqEntries = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned unsubmitted = 0;
+};
+
+enum UringResult { UringOk, UringFailed, UringUnavailable };
+
+// Streaming compression with io_uring: positional fixed reads fill registered input
+// slots, pool tasks encode them into registered output slots and fixed writes land
+// each finished block at its in-order offset. Each block reads one byte before and
+// maxBoundaryShift bytes after its nominal range, so both run-aligned cuts are found
+// without waiting for the neighbouring block. Registered buffers are pinned and
+// count against RLIMIT_MEMLOCK; when the slots do not fit under it, or registration
+// fails, plain READ/WRITE requests on the same slots are used instead. Returns
+// UringUnavailable when the ring cannot be set up, so the caller can fall back to
+// the thread pipeline, which cuts blocks on the same grid.
+UringResult streamCompressFileUring(const std::string& inFile, const std::string& outFile,
+                                    uint64_t& originalSize, uint64_t& compressedSize) {
+    const size_t depth = threadPool().size() * 2 + 2;
+    const size_t windowCapacity = streamBlockSize + maxBoundaryShift + 1;
+    const size_t outputCapacity = chunkBound(windowCapacity);
+    const size_t slotBytes = windowCapacity + outputCapacity;
+    ByteBuffer arena;  // page-aligned pool block; declared first so it outlives the ring
+    arena.allocate(slotBytes * depth);
+
+    IoRing ring;
+    if (!ring.init(static_cast<unsigned>(depth * 2 + 2))) return UringUnavailable;
+    std::vector<struct iovec> buffers;
+    for (size_t i = 0; i < depth; i++) {
+        char* base = arena.data() + i * slotBytes;
+        buffers.push_back({base, windowCapacity});
+        buffers.push_back({base + windowCapacity, outputCapacity});
+    }
+    struct rlimit memlock;
+    bool fits = getrlimit(RLIMIT_MEMLOCK, &memlock) != 0 || memlock.rlim_cur == RLIM_INFINITY ||
+                slotBytes * depth <= memlock.rlim_cur || geteuid() == 0;
+    bool fixedBuffers = fits && ring.registerBuffers(buffers);
+    runStats().streamIo = fixedBuffers ? "io_uring-fixed" : "io_uring";
+
+    int wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) return UringUnavailable;
+    int inFd = open(inFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (inFd < 0) {
+        close(wakeFd);
+        std::cerr << "Failed to open " << inFile << "\n";
+        return UringFailed;
+    }
+    int outFd = open(partialPath(outFile).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (outFd < 0) {
+        close(wakeFd);
+        close(inFd);
+        std::cerr << "Failed to create " << partialPath(outFile) << "\n";
+        return UringFailed;
+    }
+    struct stat st;
+    uint64_t size = (fstat(inFd, &st) == 0) ? static_cast<uint64_t>(st.st_size) : 0;
+    size_t blockCount = static_cast<size_t>((size + streamBlockSize - 1) / streamBlockSize);
+
+    enum SlotState { Free, Reading, Encoding, Encoded, Writing };
+    struct Slot {
+        SlotState state = Free;
+        size_t block = 0;
+        uint64_t windowStart = 0;
+        size_t windowLength = 0;
+        size_t transferred = 0;   // bytes of the current read or write completed so far
+        size_t dataStart = 0;     // run-aligned block range inside the window
+        size_t dataLength = 0;
+        ChunkEntry entry;
+    };
+    std::vector<Slot> slots(depth);
+    std::vector<ChunkEntry> chunks(blockCount);
+    std::vector<size_t> blockSlot(blockCount, SIZE_MAX);
+    std::mutex encodedMutex;
+    std::vector<size_t> encoded;       // slots finished by workers, not yet picked up
+    uint64_t wakeValue = 0;
+    const uint64_t wakeTag = UINT64_MAX;
+    const uint64_t writeFlag = 1ull << 32;
+
+    auto slotInput = [&](size_t i) { return static_cast<char*>(buffers[i * 2].iov_base); };
+    auto slotOutput = [&](size_t i) { return static_cast<char*>(buffers[i * 2 + 1].iov_base); };
+    auto queueRead = [&](size_t i) {
+        Slot& slot = slots[i];
+        return ring.queue(fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ, inFd, slotInput(i) + slot.transferred,
+                          static_cast<uint32_t>(slot.windowLength - slot.transferred),
+                          slot.windowStart + slot.transferred, static_cast<uint16_t>(i * 2), i);
+    };
+    auto queueWrite = [&](size_t i) {
+        Slot& slot = slots[i];
+        bool stored = slot.entry.method == MethodStored;
+        char* payload = stored ? slotInput(i) + slot.dataStart : slotOutput(i);
+        return ring.queue(fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, outFd, payload + slot.transferred,
+                          slot.entry.compressedLength - static_cast<uint32_t>(slot.transferred),
+                          slot.entry.compressedOffset + slot.transferred,
+                          static_cast<uint16_t>(i * 2 + (stored ? 0 : 1)), writeFlag | i);
+    };
+
+    size_t nextRead = 0, nextWrite = 0, inFlight = 0;
+    uint64_t offset = containerHeaderSize;
+    bool failed = false;
+    TaskGroup group(threadPool());
+
+    bool wakeArmed = ring.queue(IORING_OP_READ, wakeFd, &wakeValue, sizeof(wakeValue), 0, 0, wakeTag);
+    failed = !wakeArmed;
+    while (!failed && nextWrite < blockCount) {
+        // Start reads into free slots, in block order
+        for (size_t i = 0; i < depth && nextRead < blockCount; i++) {
+            if (slots[i].state != Free) continue;
+            Slot& slot = slots[i];
+            slot.block = nextRead;
+            uint64_t nominal = static_cast<uint64_t>(nextRead) * streamBlockSize;
+            slot.windowStart = nextRead ? nominal - 1 : 0;
+            slot.windowLength = static_cast<size_t>(
+                std::min<uint64_t>(size, nominal + streamBlockSize + maxBoundaryShift) - slot.windowStart);
+            slot.transferred = 0;
+            slot.state = Reading;
+            blockSlot[nextRead++] = i;
+            if (!queueRead(i)) {
+                failed = true;
+                break;
+            }
+            inFlight++;
+        }
+        // Write encoded blocks as soon as their in-order offset is known
+        while (!failed && nextWrite < blockCount && blockSlot[nextWrite] != SIZE_MAX &&
+               slots[blockSlot[nextWrite]].state == Encoded) {
+            size_t i = blockSlot[nextWrite];
+            Slot& slot = slots[i];
+            slot.entry.compressedOffset = offset;
+            offset += slot.entry.compressedLength;
+            chunks[nextWrite++] = slot.entry;
+            slot.transferred = 0;
+            if (slot.entry.compressedLength == 0) {
+                slot.state = Free;
+                continue;
+            }
+            slot.state = Writing;
+            if (!queueWrite(i)) failed = true;
+            else inFlight++;
+        }
+        if (failed || nextWrite == blockCount) break;
+
+        if (!ring.submitAndWait()) {
+            failed = true;
+            break;
+        }
+        uint64_t tag;
+        int result;
+        while (ring.nextCompletion(tag, result)) {
+            if (tag == wakeTag) {
+                if (result != static_cast<int>(sizeof(wakeValue))) {
+                    wakeArmed = false;
+                    failed = true;
+                    continue;
+                }
+                std::vector<size_t> done;
+                {
+                    std::lock_guard<std::mutex> lock(encodedMutex);
+                    done.swap(encoded);
+                }
+                for (size_t i : done) slots[i].state = Encoded;
+                wakeArmed = ring.queue(IORING_OP_READ, wakeFd, &wakeValue, sizeof(wakeValue), 0, 0, wakeTag);
+                if (!wakeArmed) failed = true;
+                continue;
+            }
+            size_t i = static_cast<size_t>(tag & (writeFlag - 1));
+            Slot& slot = slots[i];
+            inFlight--;
+            if (result <= 0) {
+                failed = true;
+                continue;
+            }
+            slot.transferred += static_cast<size_t>(result);
+            if (slot.state == Writing) {
+                if (slot.transferred < slot.entry.compressedLength) {
+                    if (queueWrite(i)) inFlight++;
+                    else failed = true;
+                } else {
+                    slot.state = Free;
+                }
+                continue;
+            }
+            if (slot.transferred < slot.windowLength) {
+                if (queueRead(i)) inFlight++;
+                else failed = true;
+                continue;
+            }
+
+            // The whole window is in: cut it at the same run-aligned points the
+            // neighbouring blocks compute for their shared boundaries
+            const char* window = slotInput(i);
+            bool last = slot.block + 1 == blockCount;
+            size_t start = slot.block ? alignToRunEnd(window, slot.windowLength, 1) : 0;
+            size_t end = last ? slot.windowLength
+                              : alignToRunEnd(window, slot.windowLength,
+                                              static_cast<size_t>((slot.block + 1) * static_cast<uint64_t>(streamBlockSize) - slot.windowStart));
+            slot.dataStart = start;
+            slot.dataLength = end > start ? end - start : 0;
+            slot.state = Encoding;
+            group.run([&, i]() {
+                Slot& work = slots[i];
+                const char* data = slotInput(i) + work.dataStart;
+                size_t encodedSize = 0;
+                work.entry.method = work.dataLength ? encodeChunk(data, work.dataLength, slotOutput(i), encodedSize)
+                                                    : MethodStored;
+                work.entry.compressedLength = static_cast<uint32_t>(work.dataLength ? encodedSize : 0);
+                work.entry.decompressedLength = static_cast<uint32_t>(work.dataLength);
+                work.entry.checksum = chunkChecksum(data, work.dataLength);
+                {
+                    std::lock_guard<std::mutex> lock(encodedMutex);
+                    encoded.push_back(i);
+                }
+                uint64_t one = 1;
+                ssize_t woken = write(wakeFd, &one, sizeof(one));
+                (void)woken;
+            });
+        }
+    }
+
+    // Drain outstanding requests before the buffers they point at are released
+    group.wait();
+    if (wakeArmed) {
+        uint64_t one = 1;
+        ssize_t woken = write(wakeFd, &one, sizeof(one));
+        (void)woken;
+    }
+    while (inFlight > 0 || wakeArmed) {
+        uint64_t tag;
+        int result;
+        if (!ring.submitAndWait()) break;
+        while (ring.nextCompletion(tag, result)) {
+            if (tag == wakeTag) wakeArmed = false;
+            else inFlight--;
+        }
+    }
+
+    ContainerHeader header;
+    header.codec = selectedCodec;
+    header.originalSize = size;
+    header.tableOffset = offset;
+    std::vector<char> table;
+    for (const ChunkEntry& chunk : chunks) {
+        if (chunk.decompressedLength == 0) continue;
+        table.resize(table.size() + chunkEntrySize);
+        writeChunkEntry(table.data() + table.size() - chunkEntrySize, chunk);
+        header.chunkCount++;
+    }
+    char headerBytes[containerHeaderSize] = {};
+    writeContainerHeader(headerBytes, header);
+    if (!failed)
+        failed = pwrite(outFd, table.data(), table.size(), static_cast<off_t>(offset)) != static_cast<ssize_t>(table.size()) ||
+                 pwrite(outFd, headerBytes, containerHeaderSize, 0) != static_cast<ssize_t>(containerHeaderSize);
+    failed = (close(outFd) != 0) || failed;
+    close(inFd);
+    close(wakeFd);
+    if (failed || !commitPartial(outFile)) {
+        std::cerr << "Streaming compression failed.\n";
+        std::remove(partialPath(outFile).c_str());
+        return UringFailed;
+    }
+    originalSize = size;
+    compressedSize = offset + table.size();
+    return UringOk;
+}
+#endif
+
+// Reader stage shared by the streaming compressors: fill block.input with the bytes
+// from `position` to the next multiple of streamBlockSize, moving the cut forward to
+// the end of a run. Cuts sit on the same absolute grid the io_uring reader uses, so
+// the output does not depend on the I/O backend. Bytes read past the cut are kept
+// in `carry` for the next block. Returns false at the end.
+bool readRunAlignedBlock(std::istream& in, std::vector<char>& carry, uint64_t& position, StreamBlock& block) {
+    // Read a little past the nominal cut so it can move to the end of a run
+    size_t target = static_cast<size_t>(streamBlockSize - position % streamBlockSize);
+    block.input.swap(carry);
+    size_t have = block.input.size();
+    block.input.resize(std::max(have, target + maxBoundaryShift));
+    in.read(block.input.data() + have, block.input.size() - have);
+    size_t total = have + static_cast<size_t>(in.gcount());
+    size_t cut = std::min(total, alignToRunEnd(block.input.data(), total, target));
+    carry.assign(block.input.begin() + cut, block.input.begin() + total);
+    block.input.resize(cut);
+    position += cut;
+    block.ok = !in.bad();
+    return !block.input.empty() || in.bad();
+}
+
+// Encode stage shared by the streaming compressors
+void encodeStreamBlock(StreamBlock& block) {
+    size_t encodedSize = 0;
+    block.output.resize(chunkBound(block.input.size()));
+    block.entry.method = encodeChunk(block.input.data(), block.input.size(), block.output.data(), encodedSize);
+    block.output.resize(block.entry.method == MethodStored ? 0 : encodedSize);
+    block.entry.compressedLength = static_cast<uint32_t>(encodedSize);
+    block.entry.decompressedLength = static_cast<uint32_t>(block.input.size());
+    block.entry.checksum = chunkChecksum(block.input.data(), block.input.size());
+}
+
+// Decode stage shared by the streaming decompressors
+void decodeStreamBlock(StreamBlock& block) {
+    if (!block.ok) return;
+    block.output.resize(block.entry.decompressedLength);
+    block.status = decodeVerifiedChunk(block.entry, block.input.data(), block.output.data(), block.checksum);
+    block.ok = block.status == ChunkOk;
+}
+
+// Keep a journal of committed blocks next to a streamed output and continue an
+// interrupted run from it (--resume)
+bool resumeOutput = false;
+
+#ifdef HAVE_MMAP
+// The journal is a 32-byte header naming the input (size and mtime) and the
+// encoding settings, then one chunk table entry per block whose payload is already
+// durable in the partial output. Data is fdatasync'd before its entries are
+// appended, and entries after it, so every entry read back describes real data.
+const char journalMagic[4] = {'R', 'L', 'E', 'J'};
+const uint8_t journalVersion = 1;
+const size_t journalHeaderSize = 32;
+const uint64_t journalCommitBytes = 64u << 20;
+
+std::string journalPath(const std::string& path) { return partialPath(path) + ".idx"; }
+
+bool pwriteAll(int fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+    return true;
+}
+
+// Chunks recorded by a previous run for the same input and settings, or none.
+// Entries must tile the partial output from the container header onwards.
+std::vector<ChunkEntry> readJournal(const std::string& path, const char* expectedHeader, uint64_t partialSize) {
+    std::vector<ChunkEntry> chunks;
+    std::ifstream in(path, std::ios::binary);
+    char header[journalHeaderSize];
+    if (!in.read(header, journalHeaderSize)) return chunks;
+    if (std::memcmp(header, expectedHeader, journalHeaderSize) != 0) {
+        std::cerr << "Journal " << path << " is for different input or settings; starting over.\n";
+        return chunks;
+    }
+    uint64_t offset = containerHeaderSize;
+    char entry[chunkEntrySize];
+    while (in.read(entry, chunkEntrySize)) {
+        ChunkEntry chunk = readChunkEntry(entry);
+        if (chunk.compressedOffset != offset || chunk.decompressedLength == 0 ||
+            offset + chunk.compressedLength > partialSize)
+            break;
+        offset += chunk.compressedLength;
+        chunks.push_back(chunk);
+    }
+    return chunks;
+}
+
+// streamCompressFile() with a journal: blocks already committed by an interrupted
+// run are kept and the input is read from the end of the last one. Chunk cuts only
+// depend on the bytes from a block's start, so the result is the same file an
+// uninterrupted run writes.
+bool resumableCompressFile(const std::string& inFile, const std::string& outFile,
+                           uint64_t& originalSize, uint64_t& compressedSize) {
+    struct stat st;
+    if (stat(inFile.c_str(), &st) != 0) {
+        std::cerr << "Failed to open " << inFile << "\n";
+        return false;
+    }
+    char journalHeader[journalHeaderSize] = {};
+    std::memcpy(journalHeader, journalMagic, sizeof(journalMagic));
+    journalHeader[4] = static_cast<char>(journalVersion);
+    journalHeader[5] = static_cast<char>(selectedCodec);
+    journalHeader[6] = static_cast<char>(ContainerHeader().flags);
+    putLE<uint64_t>(journalHeader + 8, static_cast<uint64_t>(st.st_size));
+    putLE<uint64_t>(journalHeader + 16, static_cast<uint64_t>(st.st_mtime));
+    putLE<uint32_t>(journalHeader + 24, static_cast<uint32_t>(streamBlockSize));
+
+    runStats().streamIo = "threads";
+    std::string partial = partialPath(outFile), journal = journalPath(outFile);
+    long long partialSize = fileSize(partial);
+    std::vector<ChunkEntry> chunks;
+    if (partialSize > 0) chunks = readJournal(journal, journalHeader, static_cast<uint64_t>(partialSize));
+
+    uint64_t offset = containerHeaderSize;
+    originalSize = 0;
+    for (const ChunkEntry& chunk : chunks) {
+        offset += chunk.compressedLength;
+        originalSize += chunk.decompressedLength;
+    }
+    if (!chunks.empty())
+        std::cerr << "Resuming " << outFile << " at input byte " << originalSize << " (" << chunks.size() << " blocks kept)\n";
+
+    std::ifstream in(inFile, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(originalSize));
+    int outFd = open(partial.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    int journalFd = open(journal.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    uint64_t journalSize = journalHeaderSize + chunks.size() * chunkEntrySize;
+    bool opened = in && outFd >= 0 && journalFd >= 0;
+    // Drop anything past the last committed block, including a torn journal entry
+    if (opened) {
+        char zeros[containerHeaderSize] = {};
+        opened = ftruncate(outFd, static_cast<off_t>(offset)) == 0 && pwriteAll(outFd, zeros, containerHeaderSize, 0) &&
+                 ftruncate(journalFd, static_cast<off_t>(journalSize)) == 0 &&
+                 pwriteAll(journalFd, journalHeader, journalHeaderSize, 0) && fdatasync(journalFd) == 0;
+    }
+    if (!opened) {
+        if (outFd >= 0) close(outFd);
+        if (journalFd >= 0) close(journalFd);
+        std::cerr << "Failed to open " << (in ? partial : inFile) << "\n";
+        return false;
+    }
+
+    // Make the output durable, then record its new blocks in the journal
+    size_t journaled = chunks.size();
+    uint64_t uncommitted = 0;
+    auto commit = [&]() {
+        if (fdatasync(outFd) != 0) return false;
+        std::vector<char> entries((chunks.size() - journaled) * chunkEntrySize);
+        for (size_t i = journaled; i < chunks.size(); i++)
+            writeChunkEntry(entries.data() + (i - journaled) * chunkEntrySize, chunks[i]);
+        if (!pwriteAll(journalFd, entries.data(), entries.size(), journalSize) || fdatasync(journalFd) != 0) return false;
+        journalSize += entries.size();
+        journaled = chunks.size();
+        uncommitted = 0;
+        return true;
+    };
+
+    std::vector<char> carry;
+    uint64_t position = originalSize;  // the resumed run continues on the same block grid
+    bool ok = runBlockPipeline(threadPool().size() * 2 + 2,
+        [&in, &carry, &position](StreamBlock& block) { return readRunAlignedBlock(in, carry, position, block); },
+        encodeStreamBlock,
+        [&](StreamBlock& block) {
+            if (!block.ok) {
+                std::cerr << "Failed to read " << inFile << "\n";
+                return false;
+            }
+            const std::vector<char>& payload = (block.entry.method == MethodStored) ? block.input : block.output;
+            block.entry.compressedOffset = offset;
+            if (!pwriteAll(outFd, payload.data(), payload.size(), offset)) return false;
+            chunks.push_back(block.entry);
+            offset += payload.size();
+            originalSize += block.input.size();
+            uncommitted += block.input.size();
+            return uncommitted < journalCommitBytes || commit();
+        });
+
+    ContainerHeader header;
+    header.codec = selectedCodec;
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+    header.originalSize = originalSize;
+    header.tableOffset = offset;
+    std::vector<char> table(chunks.size() * chunkEntrySize);
+    for (size_t i = 0; i < chunks.size(); i++)
+        writeChunkEntry(table.data() + i * chunkEntrySize, chunks[i]);
+    char headerBytes[containerHeaderSize] = {};
+    writeContainerHeader(headerBytes, header);
+
+    // On failure the journal keeps what was committed, ready for the next run
+    if (!ok) commit();
+    ok = ok && pwriteAll(outFd, table.data(), table.size(), offset) && pwriteAll(outFd, headerBytes, containerHeaderSize, 0);
+    ok = (close(outFd) == 0) && ok;
+    close(journalFd);
+    if (!ok || !commitPartial(outFile)) {
+        std::cerr << "Streaming compression failed; rerun with --resume to continue.\n";
+        return false;
+    }
+    unlink(journal.c_str());
+    compressedSize = offset + table.size();
+    return true;
+}
+#endif
+
+// Streaming RLE compression of inFile into a container at outFile
+bool streamCompressFile(const std::string& inFile, const std::string& outFile,
+                        uint64_t& originalSize, uint64_t& compressedSize) {
+    StageTimer timer(StageStream);
+    if (statsEnabled) timer.addBytes(static_cast<uint64_t>(std::max(0LL, fileSize(inFile))));
+#ifdef HAVE_MMAP
+    if (resumeOutput) return resumableCompressFile(inFile, outFile, originalSize, compressedSize);
+#endif
+#ifdef HAVE_IO_URING
+    if (useIoUring) {
+        UringResult result = streamCompressFileUring(inFile, outFile, originalSize, compressedSize);
+        if (result != UringUnavailable) return result == UringOk;
+    }
+#endif
+    runStats().streamIo = "threads";
+    std::ifstream in(inFile, std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open " << inFile << "\n";
+        return false;
+    }
+    std::ofstream out(partialPath(outFile), std::ios::binary);
+    if (!out) {
+        std::cerr << "Failed to create " << partialPath(outFile) << "\n";
+        return false;
+    }
+
+    // The header is patched once the chunk table position is known
+    char headerBytes[containerHeaderSize] = {};
+    out.write(headerBytes, containerHeaderSize);
+
+    std::vector<ChunkEntry> chunks;
+    uint64_t offset = containerHeaderSize;
+    originalSize = 0;
+    std::vector<char> carry;  // bytes read past the previous block's run-aligned end
+    uint64_t position = 0;
+
+    bool ok = runBlockPipeline(threadPool().size() * 2 + 2,
+        [&in, &carry, &position](StreamBlock& block) { return readRunAlignedBlock(in, carry, position, block); },
+        encodeStreamBlock,
+        [&out, &chunks, &offset, &originalSize, &inFile](StreamBlock& block) {
+            if (!block.ok) {
+                std::cerr << "Failed to read " << inFile << "\n";
+                return false;
+            }
+            const std::vector<char>& payload = (block.entry.method == MethodStored) ? block.input : block.output;
+            block.entry.compressedOffset = offset;
+            out.write(payload.data(), payload.size());
+            chunks.push_back(block.entry);
+            offset += payload.size();
+            originalSize += block.input.size();
+            return static_cast<bool>(out);
+        });
+    if (!ok) {
+        std::cerr << "Streaming compression failed.\n";
+        std::remove(partialPath(outFile).c_str());
+        return false;
+    }
+
+    ContainerHeader header;
+    header.codec = selectedCodec;
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+    header.originalSize = originalSize;
+    header.tableOffset = offset;
+
+    std::vector<char> table(chunks.size() * chunkEntrySize);
+    for (size_t i = 0; i < chunks.size(); i++)
+        writeChunkEntry(table.data() + i * chunkEntrySize, chunks[i]);
+    out.write(table.data(), table.size());
+
+    writeContainerHeader(headerBytes, header);
+    out.seekp(0);
+    out.write(headerBytes, containerHeaderSize);
+    compressedSize = offset + table.size();
+    out.close();
+    if (!out || !commitPartial(outFile)) {
+        std::cerr << "Failed to write " << outFile << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Streaming decompression of a container file; only the chunk table is held in full
+bool streamDecompressFile(const std::string& inFile, const std::string& outFile,
+                          uint64_t& decompressedSize) {
+    StageTimer timer(StageStream);
+    if (statsEnabled) timer.addBytes(static_cast<uint64_t>(std::max(0LL, fileSize(inFile))));
+    std::ifstream in(inFile, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "Failed to open " << inFile << "\n";
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    char headerBytes[containerHeaderSize] = {};
+    in.read(headerBytes, containerHeaderSize);
+    ContainerHeader header;
+    if (!in || !parseContainerHeader(headerBytes, size, header)) {
+        std::cerr << "Invalid compressed file.\n";
+        return false;
+    }
+
+    std::vector<char> table(static_cast<size_t>(header.chunkCount) * chunkEntrySize);
+    in.seekg(static_cast<std::streamoff>(header.tableOffset));
+    in.read(table.data(), table.size());
+    std::vector<ChunkEntry> chunks;
+    if (!in || !parseChunkTable(table.data(), header, chunks)) {
+        std::cerr << "Invalid compressed file.\n";
+        return false;
+    }
+
+    // "-" sends the output to stdout; files are renamed into place once complete
+    DecodedFile file(outFile);
+    std::ostream& out = file.stream();
+    if (!out) {
+        std::cerr << "Failed to create " << file.path() << "\n";
+        return false;
+    }
+
+    size_t next = 0;
+    decompressedSize = 0;
+    bool ok = runBlockPipeline(threadPool().size() * 2 + 2,
+        [&in, &chunks, &next, &header](StreamBlock& block) {
+            if (next == chunks.size()) return false;
+            block.entry = chunks[next++];
+            block.checksum = checksumTypeOf(header.flags);
+            block.input.resize(block.entry.compressedLength);
+            in.seekg(static_cast<std::streamoff>(block.entry.compressedOffset));
+            in.read(block.input.data(), block.input.size());
+            block.ok = static_cast<bool>(in);
+            block.status = block.ok ? ChunkOk : ChunkReadFailed;
+            return true;
+        },
+        decodeStreamBlock,
+        [&out, &decompressedSize](StreamBlock& block) {
+            if (!block.ok) {
+                std::cerr << "Chunk at offset " << block.entry.compressedOffset << " "
+                          << chunkStatusText(block.status) << ".\n";
+                return false;
+            }
+            out.write(block.output.data(), block.output.size());
+            decompressedSize += block.output.size();
+            return static_cast<bool>(out);
+        });
+    if (!ok) {
+        std::cerr << "Streaming decompression failed.\n";
+        return false;
+    }
+    if (!file.close()) {
+        std::cerr << "Failed to write " << outFile << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Framed stream format for pipes, where the total size is not known up front and
+// the output cannot be patched: an 8-byte stream header (magic, version, codec,
+// flags as in the container header), then one frame per block (16-byte frame
+// header: decompressed length, compressed length, checksum, method; then the
+// payload) and an empty frame marking the end, so a truncated stream is detected.
+const char framedMagic[4] = {'R', 'L', 'E', 'S'};
+const uint8_t framedVersion = 1;
+const size_t framedHeaderSize = 8;
+const size_t frameHeaderSize = 16;
+const uint32_t maxFrameSize = 64u << 20;
+
+bool isFramedStream(const char* data, size_t size) {
+    return size >= sizeof(framedMagic) && std::memcmp(data, framedMagic, sizeof(framedMagic)) == 0;
+}
+
+void writeFrameHeader(char* out, const ChunkEntry& entry) {
+    std::memset(out, 0, frameHeaderSize);
+    putLE<uint32_t>(out, entry.decompressedLength);
+    putLE<uint32_t>(out + 4, entry.compressedLength);
+    putLE<uint32_t>(out + 8, entry.checksum);
+    out[12] = static_cast<char>(entry.method);
+}
+
+ChunkEntry readFrameHeader(const char* in) {
+    ChunkEntry entry;
+    entry.decompressedLength = getLE<uint32_t>(in);
+    entry.compressedLength = getLE<uint32_t>(in + 4);
+    entry.checksum = getLE<uint32_t>(in + 8);
+    entry.method = static_cast<uint8_t>(in[12]);
+    return entry;
+}
+
+// Compress `in` into the framed format on `out`, encoding blocks in parallel and
+// writing them in order as they finish
+bool compressStream(std::istream& in, std::ostream& out, uint64_t& inSize, uint64_t& outSize) {
+    StageTimer timer(StageStream);
+    char streamHeader[framedHeaderSize] = {};
+    std::memcpy(streamHeader, framedMagic, sizeof(framedMagic));
+    streamHeader[4] = static_cast<char>(framedVersion);
+    streamHeader[5] = static_cast<char>(selectedCodec);
+    streamHeader[6] = static_cast<char>(containerFlagCrc32c);
+    out.write(streamHeader, framedHeaderSize);
+    inSize = 0;
+    outSize = framedHeaderSize;
+
+    std::vector<char> carry;
+    uint64_t position = 0;
+    bool ok = runBlockPipeline(threadPool().size() * 2 + 2,
+        [&in, &carry, &position](StreamBlock& block) { return readRunAlignedBlock(in, carry, position, block); },
+        encodeStreamBlock,
+        [&out, &inSize, &outSize](StreamBlock& block) {
+            if (!block.ok) {
+                std::cerr << "Failed to read input stream.\n";
+                return false;
+            }
+            char frameHeader[frameHeaderSize];
+            writeFrameHeader(frameHeader, block.entry);
+            const std::vector<char>& payload = (block.entry.method == MethodStored) ? block.input : block.output;
+            out.write(frameHeader, frameHeaderSize);
+            out.write(payload.data(), payload.size());
+            inSize += block.input.size();
+            outSize += frameHeaderSize + payload.size();
+            return static_cast<bool>(out);
+        });
+
+    // Without the end frame a failed run reads as a truncated stream downstream
+    if (ok) {
+        char endFrame[frameHeaderSize] = {};
+        out.write(endFrame, frameHeaderSize);
+        outSize += frameHeaderSize;
+    }
+    timer.addBytes(inSize);
+    if (!out.flush() || !ok) {
+        std::cerr << "Streaming compression failed.\n";
+        return false;
+    }
+    return true;
+}
+
+// Decompress a framed stream from `in` to `out`, decoding frames in parallel
+bool decompressStream(std::istream& in, std::ostream& out, uint64_t& inSize, uint64_t& outSize) {
+    StageTimer timer(StageStream);
+    char streamHeader[framedHeaderSize] = {};
+    in.read(streamHeader, framedHeaderSize);
+    if (!in || !isFramedStream(streamHeader, framedHeaderSize) || static_cast<uint8_t>(streamHeader[4]) != framedVersion) {
+        std::cerr << "Input is not a framed stream.\n";
+        return false;
+    }
+    inSize = framedHeaderSize;
+    outSize = 0;
+
+    ChecksumType checksum = checksumTypeOf(static_cast<uint8_t>(streamHeader[6]));
+    bool ended = false, malformed = false;
+    bool ok = runBlockPipeline(threadPool().size() * 2 + 2,
+        [&in, &inSize, &ended, &malformed, checksum](StreamBlock& block) {
+            char frameHeader[frameHeaderSize];
+            in.read(frameHeader, frameHeaderSize);
+            if (!in) return false;
+            block.entry = readFrameHeader(frameHeader);
+            block.checksum = checksum;
+            if (block.entry.decompressedLength == 0 && block.entry.compressedLength == 0) {
+                ended = true;
+                return false;
+            }
+            if (block.entry.decompressedLength > maxFrameSize || block.entry.compressedLength > maxFrameSize) {
+                malformed = true;
+                return false;
+            }
+            block.input.resize(block.entry.compressedLength);
+            in.read(block.input.data(), block.input.size());
+            block.ok = static_cast<bool>(in);
+            block.status = block.ok ? ChunkOk : ChunkReadFailed;
+            inSize += frameHeaderSize + block.input.size();
+            return true;
+        },
+        decodeStreamBlock,
+        [&out, &outSize](StreamBlock& block) {
+            if (!block.ok) {
+                std::cerr << "Frame " << chunkStatusText(block.status) << ".\n";
+                return false;
+            }
+            out.write(block.output.data(), block.output.size());
+            outSize += block.output.size();
+            return static_cast<bool>(out);
+        });
+    inSize += ended ? frameHeaderSize : 0;
+    timer.addBytes(outSize);
+    if (ok && malformed) std::cerr << "Corrupt frame header.\n";
+    else if (ok && !ended) std::cerr << "Truncated stream (no end frame).\n";
+    if (!ok || malformed || !ended || !out.flush()) {
+        std::cerr << "Streaming decompression failed.\n";
+        return false;
+    }
+    return true;
+}
+
+// Interactive file creation: user enters lines, saved to disk
+void createFile() {
+    std::string filename;
+    std::cout << "Enter filename to create: ";
+    std::getline(std::cin, filename);
+
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "Cannot create file.\n";
+        return;
+    }
+
+    std::cout << "Enter text lines (empty line to finish):\n";
+    while (true) {
+        std::string line;
+        std::getline(std::cin, line);
+        if (line.empty()) break;
+        out << line << "\n";
+    }
+
+    std::cout << "File \"" << filename << "\" created.\n";
+}
+
+// Compressed form of an in-memory input. Chunks are encoded in place into
+// worst-case slices of one slab, and the file is described as a list of segments
+// (header, used part of each slice, table) so it can be written without merging.
+struct CompressedOutput {
+    std::vector<char> header;
+    ByteBuffer slab;
+    std::vector<char> table;
+    std::vector<OutputSegment> segments;
+    bool stored = false;
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& segment : segments) total += segment.size;
+        return total;
+    }
+};
+
+// Multithreaded RLE compression of an in-memory buffer into a container.
+// Falls back to the legacy 'U' header + raw data when RLE does not pay off;
+// the stored form then refers to `data` directly, which must outlive the result.
+void compressBuffer(const InputBuffer& data, CompressedOutput& output) {
+    // Split into run-aligned chunks, several per pool worker
+    // Small inputs are planned for a single worker so the pool is never started for them
+    unsigned int numThreads = (data.size() < smallInputThreshold) ? 1 : threadPool().size();
+    std::vector<size_t> boundaries = planChunks(data.data(), data.size(), numThreads);
+    size_t chunkCount = boundaries.size() - 1;
+
+    // Every chunk gets a worst-case slice of the slab; pages it never writes stay untouched
+    std::vector<size_t> sliceOffsets(chunkCount + 1, 0);
+    for (size_t i = 0; i < chunkCount; i++)
+        sliceOffsets[i + 1] = sliceOffsets[i] + chunkBound(boundaries[i + 1] - boundaries[i]);
+    output.slab.allocate(sliceOffsets[chunkCount] + 1);
+    std::vector<size_t> compressedSizes(chunkCount);
+    std::vector<ChunkMethod> methods(chunkCount);
+    std::vector<uint32_t> checksums(chunkCount);
+
+    // Compress each chunk as a pool task
+    StageTimer encodeTimer(StageEncode, data.size());
+    parallelFor(chunkCount, [&](size_t i) {
+        size_t start = boundaries[i];
+        size_t end = boundaries[i + 1];
+        methods[i] = encodeChunk(data.data() + start, end - start, output.slab.data() + sliceOffsets[i],
+                                 compressedSizes[i]);
+        checksums[i] = chunkChecksum(data.data() + start, end - start);
+    }, data.size());
+    encodeTimer.finish();
+
+    // Lay the chunks out behind the header and record where each one lands
+    StageTimer layoutTimer(StageLayout, data.size());
+    std::vector<ChunkEntry> chunks;
+    output.segments.clear();
+    output.segments.push_back({nullptr, containerHeaderSize});
+    uint64_t offset = containerHeaderSize;
+    for (size_t i = 0; i < chunkCount; i++) {
+        size_t start = boundaries[i];
+        size_t end = boundaries[i + 1];
+
+        ChunkEntry entry;
+        entry.compressedOffset = offset;
+        entry.compressedLength = static_cast<uint32_t>(compressedSizes[i]);
+        entry.decompressedLength = static_cast<uint32_t>(end - start);
+        entry.checksum = checksums[i];
+        entry.method = methods[i];
+        chunks.push_back(entry);
+
+        // Stored chunks are written straight from the input
+        const char* payload = (methods[i] == MethodStored) ? data.data() + start : output.slab.data() + sliceOffsets[i];
+        output.segments.push_back({payload, compressedSizes[i]});
+        offset += compressedSizes[i];
+    }
+
+    ContainerHeader header;
+    header.codec = selectedCodec;
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+    header.originalSize = data.size();
+    header.tableOffset = offset;
+    output.table.resize(chunks.size() * chunkEntrySize);
+    for (size_t i = 0; i < chunks.size(); i++)
+        writeChunkEntry(output.table.data() + i * chunkEntrySize, chunks[i]);
+    output.segments.push_back({output.table.data(), output.table.size()});
+
+    output.stored = offset + output.table.size() >= data.size();
+    if (!output.stored) {
+        output.header.resize(containerHeaderSize);
+        writeContainerHeader(output.header.data(), header);
+        output.segments.front().data = output.header.data();
+        return;
+    }
+
+    output.slab.reset();
+    output.table.clear();
+    output.header.assign(1, 'U');
+    output.segments.clear();
+    output.segments.push_back({output.header.data(), 1});
+    output.segments.push_back({data.data(), data.size()});
+}
+
+// Multithreaded decompression of an in-memory container or legacy 'C'/'U' file image.
+// On success, `format` describes how the data was stored.
+bool decompressBuffer(const InputBuffer& data, ByteBuffer& decompressed,
+                      size_t& payloadSize, std::string& format) {
+    if (data.empty()) return false;
+    char header = data.data()[0];
+    payloadSize = data.size() - 1;
+
+    if (isContainer(data.data(), data.size())) {
+        ContainerHeader container;
+        std::vector<ChunkEntry> chunks;
+        if (!parseContainer(data.data(), data.size(), container, chunks)) {
+            std::cerr << "Invalid compressed file.\n";
+            return false;
+        }
+
+        // Each chunk's output position follows from the decompressed lengths before it
+        std::vector<size_t> outOffsets(chunks.size());
+        size_t outPos = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            outOffsets[i] = outPos;
+            outPos += chunks[i].decompressedLength;
+        }
+        decompressed.allocate(outPos);
+
+        std::vector<ChunkStatus> status(chunks.size(), ChunkOk);
+
+        // Each chunk is a pool task that decodes straight into its final place
+        StageTimer decodeTimer(StageDecode, outPos);
+        parallelFor(chunks.size(), [&](size_t i) {
+            const ChunkEntry& entry = chunks[i];
+            status[i] = decodeVerifiedChunk(entry, data.data() + entry.compressedOffset,
+                                            decompressed.data() + outOffsets[i], checksumTypeOf(container.flags));
+        }, outPos);
+
+        bool allOk = true;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (status[i] != ChunkOk) {
+                std::cerr << "Chunk " << i << " " << chunkStatusText(status[i]) << ".\n";
+                allOk = false;
+            }
+        }
+        if (!allOk) return false;
+
+        payloadSize = container.tableOffset - containerHeaderSize;
+        size_t storedChunks = 0;
+        for (const auto& entry : chunks)
+            if (entry.method == MethodStored) storedChunks++;
+        format = "RLE (" + std::to_string(chunks.size()) + " chunks, " + std::to_string(storedChunks) + " stored)";
+
+    } else if (header == 'C') {
+        const char* rawData = data.data() + 1;
+        size_t rawSize = data.size() - 1;
+
+        unsigned int numThreads = (rawSize < smallInputThreshold) ? 1 : threadPool().size();
+        StageTimer decodeTimer(StageDecode);
+
+        size_t pairCount = rawSize / 2;
+        size_t pairsPerThread = pairCount / numThreads;
+
+        auto segmentStart = [&](size_t i) { return i * pairsPerThread * 2; };
+        auto segmentEnd = [&](size_t i) { return (i == numThreads -1) ? pairCount * 2 : segmentStart(i + 1); };
+
+        // Legacy files carry no sizes, so a first parallel pass sums each segment's run counts
+        std::vector<size_t> outOffsets(numThreads + 1, 0);
+        parallelFor(numThreads, [&](size_t i) {
+            outOffsets[i + 1] = rleDecodedSize(rawData + segmentStart(i), segmentEnd(i) - segmentStart(i));
+        });
+        for (unsigned int i = 0; i < numThreads; i++)
+            outOffsets[i + 1] += outOffsets[i];
+        decompressed.allocate(outOffsets[numThreads]);
+
+        // Decompress each segment as a pool task directly into its final place
+        std::vector<char> segmentOk(numThreads, 0);
+        decodeTimer.addBytes(outOffsets[numThreads]);
+        parallelFor(numThreads, [&](size_t i) {
+            WorkTimer work(outOffsets[i + 1] - outOffsets[i]);
+            segmentOk[i] = decompressRLEChunk(rawData + segmentStart(i), segmentEnd(i) - segmentStart(i),
+                                              decompressed.data() + outOffsets[i], outOffsets[i + 1] - outOffsets[i]);
+        });
+        for (unsigned int i = 0; i < numThreads; i++) {
+            if (!segmentOk[i]) {
+                std::cerr << "Corrupt RLE data.\n";
+                return false;
+            }
+        }
+
+        format = "RLE";
+
+    } else if (header == 'U') {
+        // File was stored uncompressed
+        StageTimer decodeTimer(StageDecode, data.size() - 1);
+        WorkTimer work(data.size() - 1);
+        decompressed.allocate(data.size() - 1);
+        parallelCopy(decompressed.data(), data.data() + 1, data.size() - 1);
+        format = "uncompressed";
+    } else {
+        std::cerr << "Unknown file format header.\n";
+        return false;
+    }
+    return true;
 }
 
-// Decompress a chunk of RLE-compressed data
-std::vector<char> decompressRLEChunk(const std::vector<char>& data, size_t start, size_t end) {
-    std::vector<char> decompressed;
-    if ((end - start) % 2 != 0) {
-        std::lock_guard<std::mutex> lock(coutMutex);
-        std::cerr << "Invalid compressed chunk size\n";
-        return decompressed;
+// Stream buffer that discards everything written to it, for verification runs
+class DiscardBuffer : public std::streambuf {
+protected:
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+// Verify a compressed file without writing any output. Container chunks are decoded
+// by pool tasks into scratch buffers and checked against their checksums, so a test
+// runs at full decode speed on every core; framed streams go through the streaming
+// decoder and legacy files through decompressBuffer. `summary` describes the file.
+bool testCompressedFile(const std::string& filename, std::string& summary) {
+    std::ifstream probe(filename, std::ios::binary);
+    char magic[containerHeaderSize] = {};
+    probe.read(magic, sizeof(magic));
+    if (probe.gcount() >= static_cast<std::streamsize>(sizeof(framedMagic)) && isFramedStream(magic, sizeof(framedMagic))) {
+        probe.seekg(0);
+        probe.clear();
+        DiscardBuffer discard;
+        std::ostream sink(&discard);
+        uint64_t inSize = 0, outSize = 0;
+        if (!decompressStream(probe, sink, inSize, outSize)) return false;
+        summary = "framed stream, " + std::to_string(outSize) + " bytes";
+        return true;
     }
-    for (size_t i = start; i < end; i += 2) {
-        char c = data[i];
-        unsigned char count = static_cast<unsigned char>(data[i + 1]);
-        decompressed.insert(decompressed.end(), count, c);
+
+    InputBuffer data = mapFile(filename);
+    if (data.empty()) {
+        std::cerr << "Failed to read " << filename << "\n";
+        return false;
+    }
+    if (!isContainer(data.data(), data.size())) {
+        ByteBuffer decompressed;
+        size_t payloadSize = 0;
+        std::string format;
+        if (!decompressBuffer(data, decompressed, payloadSize, format)) return false;
+        summary = format + ", " + std::to_string(decompressed.size()) + " bytes";
+        return true;
+    }
+
+    ContainerHeader header;
+    std::vector<ChunkEntry> chunks;
+    if (!parseContainer(data.data(), data.size(), header, chunks)) {
+        std::cerr << "Invalid compressed file.\n";
+        return false;
+    }
+    std::vector<ChunkStatus> status(chunks.size(), ChunkOk);
+    StageTimer decodeTimer(StageDecode, header.originalSize);
+    parallelFor(chunks.size(), [&](size_t i) {
+        ByteBuffer scratch;
+        scratch.allocate(chunks[i].decompressedLength);
+        status[i] = decodeVerifiedChunk(chunks[i], data.data() + chunks[i].compressedOffset, scratch.data(),
+                                        checksumTypeOf(header.flags));
+    }, header.originalSize);
+
+    bool allOk = true;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (status[i] != ChunkOk) {
+            std::cerr << "Chunk " << i << " " << chunkStatusText(status[i]) << ".\n";
+            allOk = false;
+        }
     }
-    return decompressed;
+    summary = std::to_string(chunks.size()) + " chunks, " + std::to_string(header.originalSize) + " bytes, " +
+              (checksumTypeOf(header.flags) == ChecksumCrc32c ? "CRC32C" : "FNV-1a");
+    return allOk;
 }
 
-// Write binary data to file
-bool writeFile(const std::string& filename, const std::vector<char>& data) {
-    std::ofstream out(filename, std::ios::binary);
-    if (!out) return false;
-    out.write(data.data(), data.size());
-    return true;
+// Read and validate just the container header of a file
+bool readContainerHeader(const std::string& filename, ContainerHeader& header) {
+    long long size = fileSize(filename);
+    if (size < static_cast<long long>(containerHeaderSize)) return false;
+
+    std::ifstream probe(filename, std::ios::binary);
+    char headerBytes[containerHeaderSize] = {};
+    probe.read(headerBytes, containerHeaderSize);
+    return probe && parseContainerHeader(headerBytes, size, header);
 }
 
-// Read entire binary file into a vector<char>
-std::vector<char> readFile(const std::string& filename) {
-    std::ifstream in(filename, std::ios::binary);
+// Whether a compressed file expands to enough data to go through the streaming pipeline
+bool isLargeContainer(const std::string& filename) {
+    ContainerHeader header;
+    return readContainerHeader(filename, header) && header.originalSize >= streamThreshold;
+}
+
+// Bytes a compressed file expands to, or 0 if that is not known up front
+// (legacy 'C' files carry no size)
+uint64_t decompressedSizeOf(const std::string& filename) {
+    ContainerHeader header;
+    if (readContainerHeader(filename, header)) return header.originalSize;
+    std::ifstream probe(filename, std::ios::binary);
+    long long size = fileSize(filename);
+    return (probe.get() == 'U' && size > 0) ? static_cast<uint64_t>(size - 1) : 0;
+}
+
+// Decompress only bytes [offset, offset + length) of a compressed file into `out`;
+// the range is clipped to the end of the data. For containers this reads the header,
+// the chunk table and just the chunks overlapping the range, which are decoded in
+// parallel: inner chunks straight into place, the two edge chunks via scratch.
+// Legacy 'U' files are sliced directly; legacy 'C' files have no index and are
+// decoded whole.
+bool decompressRange(const std::string& filename, uint64_t offset, uint64_t length, ByteBuffer& out) {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
     if (!in) {
         std::cerr << "Failed to open " << filename << "\n";
-        return {};
+        return false;
     }
-    in.seekg(0, std::ios::end);
-    size_t size = (size_t)in.tellg();
-    in.seekg(0, std::ios::beg);
-    std::vector<char> data(size);
-    in.read(data.data(), size);
-    return data;
+    uint64_t size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+    char headerBytes[containerHeaderSize] = {};
+    in.read(headerBytes, std::min<uint64_t>(size, containerHeaderSize));
+
+    if (size >= containerHeaderSize && isContainer(headerBytes, containerHeaderSize)) {
+        ContainerHeader header;
+        if (!parseContainerHeader(headerBytes, size, header)) {
+            std::cerr << "Invalid compressed file.\n";
+            return false;
+        }
+        std::vector<char> table(static_cast<size_t>(header.chunkCount) * chunkEntrySize);
+        in.seekg(static_cast<std::streamoff>(header.tableOffset));
+        in.read(table.data(), table.size());
+        std::vector<ChunkEntry> chunks;
+        if (!in || !parseChunkTable(table.data(), header, chunks)) {
+            std::cerr << "Invalid compressed file.\n";
+            return false;
+        }
+        if (offset > header.originalSize) {
+            std::cerr << "Range starts past the end of the data (" << header.originalSize << " bytes).\n";
+            return false;
+        }
+        length = std::min(length, header.originalSize - offset);
+        out.allocate(static_cast<size_t>(length));
+        if (length == 0) return true;
+
+        // Chunks overlapping the range: the first one ending after `offset` up to the
+        // last one starting before its end
+        std::vector<uint64_t> starts(chunks.size() + 1, 0);
+        for (size_t i = 0; i < chunks.size(); i++) starts[i + 1] = starts[i] + chunks[i].decompressedLength;
+        size_t first = static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin()) - 1;
+        size_t last = static_cast<size_t>(std::lower_bound(starts.begin(), starts.end(), offset + length) - starts.begin());
+
+        // One read covers the compressed bytes of every overlapping chunk
+        uint64_t spanStart = UINT64_MAX, spanEnd = 0;
+        for (size_t i = first; i < last; i++) {
+            spanStart = std::min(spanStart, chunks[i].compressedOffset);
+            spanEnd = std::max(spanEnd, chunks[i].compressedOffset + chunks[i].compressedLength);
+        }
+        ByteBuffer span;
+        span.allocate(static_cast<size_t>(spanEnd - spanStart));
+        {
+            StageTimer timer(StageRead, span.size());
+            in.seekg(static_cast<std::streamoff>(spanStart));
+            in.read(span.data(), span.size());
+        }
+        if (!in) {
+            std::cerr << "Failed to read " << filename << "\n";
+            return false;
+        }
+
+        std::vector<ChunkStatus> status(last - first, ChunkOk);
+        StageTimer decodeTimer(StageDecode, length);
+        parallelFor(last - first, [&](size_t k) {
+            size_t i = first + k;
+            const ChunkEntry& entry = chunks[i];
+            const char* payload = span.data() + (entry.compressedOffset - spanStart);
+            uint64_t from = std::max(offset, starts[i]);
+            uint64_t to = std::min(offset + length, starts[i + 1]);
+            char* target = out.data() + (from - offset);
+            if (from == starts[i] && to == starts[i + 1]) {
+                status[k] = decodeVerifiedChunk(entry, payload, target, checksumTypeOf(header.flags));
+                return;
+            }
+            ByteBuffer scratch;
+            scratch.allocate(entry.decompressedLength);
+            status[k] = decodeVerifiedChunk(entry, payload, scratch.data(), checksumTypeOf(header.flags));
+            if (status[k] == ChunkOk) std::memcpy(target, scratch.data() + (from - starts[i]), to - from);
+        }, length);
+
+        bool allOk = true;
+        for (size_t k = 0; k < status.size(); k++) {
+            if (status[k] != ChunkOk) {
+                std::cerr << "Chunk " << first + k << " " << chunkStatusText(status[k]) << ".\n";
+                allOk = false;
+            }
+        }
+        return allOk;
+    }
+
+    if (size > 0 && headerBytes[0] == 'U') {
+        uint64_t dataSize = size - 1;
+        if (offset > dataSize) {
+            std::cerr << "Range starts past the end of the data (" << dataSize << " bytes).\n";
+            return false;
+        }
+        length = std::min(length, dataSize - offset);
+        out.allocate(static_cast<size_t>(length));
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(1 + offset));
+        in.read(out.data(), out.size());
+        if (!in) {
+            std::cerr << "Failed to read " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    InputBuffer data = mapFile(filename);
+    ByteBuffer whole;
+    size_t payloadSize = 0;
+    std::string format;
+    if (!decompressBuffer(data, whole, payloadSize, format)) return false;
+    if (offset > whole.size()) {
+        std::cerr << "Range starts past the end of the data (" << whole.size() << " bytes).\n";
+        return false;
+    }
+    length = std::min<uint64_t>(length, whole.size() - offset);
+    out.allocate(static_cast<size_t>(length));
+    std::memcpy(out.data(), whole.data() + offset, static_cast<size_t>(length));
+    return true;
 }
 
-// Interactive file creation: user enters lines, saved to disk
-void createFile() {
-    std::string filename;
-    std::cout << "Enter filename to create: ";
-    std::getline(std::cin, filename);
+// Multi-file archives are containers with containerFlagArchive set. The payload is
+// the members' bytes back to back; a member table after the chunk table names them:
+// member count (u32), then per member name length (u16), size (u64) and the name.
+// Files below archiveCoalesceLimit are packed together into shared chunks of about
+// archiveBlockSize, so thousands of tiny files cost a few large chunks rather
+// than one chunk (and table entry) each; larger files get chunks of their own.
+const size_t archiveCoalesceLimit = minChunkSize;
+const size_t archiveBlockSize = 1u << 20;
 
-    std::ofstream out(filename);
+struct ArchiveMember {
+    std::string name;  // relative path with '/' separators
+    uint64_t offset = 0;  // position in the uncompressed payload
+    uint64_t size = 0;
+};
+
+// Parse a member table; members must tile the payload exactly
+bool parseMemberTable(const char* data, size_t size, uint64_t originalSize, std::vector<ArchiveMember>& members) {
+    members.clear();
+    if (size < 4) return false;
+    uint32_t count = getLE<uint32_t>(data);
+    size_t pos = 4;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (size - pos < 10) return false;
+        ArchiveMember member;
+        uint16_t nameLength = getLE<uint16_t>(data + pos);
+        member.size = getLE<uint64_t>(data + pos + 2);
+        pos += 10;
+        if (size - pos < nameLength || member.size > originalSize - std::min(offset, originalSize)) return false;
+        member.name.assign(data + pos, nameLength);
+        member.offset = offset;
+        pos += nameLength;
+        offset += member.size;
+        members.push_back(std::move(member));
+    }
+    return offset == originalSize;
+}
+
+// Read an archive's header and member table without touching the payload
+bool readArchiveIndex(const std::string& filename, ContainerHeader& header, std::vector<ArchiveMember>& members) {
+    if (!readContainerHeader(filename, header) || !(header.flags & containerFlagArchive)) {
+        std::cerr << filename << " is not an archive.\n";
+        return false;
+    }
+    uint64_t tableEnd = header.tableOffset + static_cast<uint64_t>(header.chunkCount) * chunkEntrySize;
+    uint64_t size = static_cast<uint64_t>(fileSize(filename));
+    std::vector<char> table(static_cast<size_t>(size - tableEnd));
+    std::ifstream in(filename, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(tableEnd));
+    in.read(table.data(), table.size());
+    if (!in || !parseMemberTable(table.data(), table.size(), header.originalSize, members)) {
+        std::cerr << "Corrupt member table in " << filename << ".\n";
+        return false;
+    }
+    return true;
+}
+
+// The files an archive input stands for: the path itself, or every regular file
+// below it (in name order) when it is a directory
+bool collectArchiveInputs(const std::string& input, std::vector<std::string>& paths) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(input, error)) {
+        paths.push_back(input);
+        return true;
+    }
+    std::vector<std::string> found;
+    for (auto it = std::filesystem::recursive_directory_iterator(input, error);
+         !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (it->is_regular_file(error)) found.push_back(it->path().generic_string());
+    }
+    if (error) {
+        std::cerr << "Failed to list " << input << ": " << error.message() << "\n";
+        return false;
+    }
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), found.begin(), found.end());
+    return true;
+}
+
+// Member name for an input path: normalised, with root and leading ".." components
+// dropped as tar does, so every name extracts safely below the target directory
+std::string archiveMemberName(const std::string& path, bool& stripped) {
+    std::filesystem::path name;
+    bool leading = true;
+    for (const auto& part : std::filesystem::path(path).lexically_normal().relative_path()) {
+        if (leading && (part == ".." || part == ".")) {
+            stripped = true;
+            continue;
+        }
+        leading = false;
+        name /= part;
+    }
+    if (std::filesystem::path(path).has_root_path()) stripped = true;
+    return name.generic_string();
+}
+
+// Files at least this large are read through the block pipeline; smaller ones are
+// mapped and encoded in batches of about this many bytes, so memory stays bounded
+// however large the archive is
+const size_t archiveBatchSize = 16u << 20;
+
+// Compress every input (files or directories) into one archive at outFile.
+// Chunks are encoded in batches of pool tasks and written as each batch completes.
+bool createArchive(const std::vector<std::string>& inputs, const std::string& outFile,
+                   uint64_t& originalSize, uint64_t& compressedSize) {
+    std::vector<std::string> paths;
+    for (const std::string& input : inputs)
+        if (!collectArchiveInputs(input, paths)) return false;
+
+    std::string partial = partialPath(outFile);
+    std::ofstream out(partial, std::ios::binary);
     if (!out) {
-        std::cerr << "Cannot create file.\n";
-        return;
+        std::cerr << "Failed to create " << partial << "\n";
+        return false;
     }
+    char headerBytes[containerHeaderSize] = {};
+    out.write(headerBytes, containerHeaderSize);
+    auto fail = [&](const std::string& message) {
+        std::cerr << message << "\n";
+        out.close();
+        std::remove(partial.c_str());
+        return false;
+    };
 
-    std::cout << "Enter text lines (empty line to finish):\n";
-    while (true) {
-        std::string line;
-        std::getline(std::cin, line);
-        if (line.empty()) break;
-        out << line << "\n";
+    struct ArchiveChunk {
+        const char* data;
+        size_t size;
+    };
+    std::vector<ArchiveMember> members;
+    std::vector<ChunkEntry> chunks;
+    std::vector<ArchiveChunk> plan;               // chunks of the current batch
+    size_t planBytes = 0;
+    std::deque<InputBuffer> mappedFiles;          // files of the current batch, encoded in place
+    std::deque<std::vector<char>> sharedBlocks;   // small files copied together; the last one is open
+    uint64_t offset = 0, position = containerHeaderSize;
+
+    auto openSharedBlock = [&]() {
+        sharedBlocks.emplace_back();
+        sharedBlocks.back().reserve(archiveBlockSize + archiveCoalesceLimit);
+    };
+    auto closeSharedBlock = [&]() {
+        if (sharedBlocks.back().empty()) return;
+        plan.push_back({sharedBlocks.back().data(), sharedBlocks.back().size()});
+        planBytes += sharedBlocks.back().size();
+        openSharedBlock();
+    };
+    openSharedBlock();
+
+    // Encode the batch into worst-case slices of one slab, as compressBuffer does, and
+    // append it to the output
+    auto flushBatch = [&]() {
+        std::vector<size_t> sliceOffsets(plan.size() + 1, 0);
+        for (size_t i = 0; i < plan.size(); i++) sliceOffsets[i + 1] = sliceOffsets[i] + chunkBound(plan[i].size);
+        ByteBuffer slab;
+        slab.allocate(sliceOffsets[plan.size()] + 1);
+        std::vector<ChunkEntry> batch(plan.size());
+        {
+            StageTimer timer(StageEncode, planBytes);
+            parallelFor(plan.size(), [&](size_t i) {
+                size_t encodedSize = 0;
+                batch[i].method = encodeChunk(plan[i].data, plan[i].size, slab.data() + sliceOffsets[i], encodedSize);
+                batch[i].compressedLength = static_cast<uint32_t>(encodedSize);
+                batch[i].decompressedLength = static_cast<uint32_t>(plan[i].size);
+                batch[i].checksum = chunkChecksum(plan[i].data, plan[i].size);
+            }, planBytes);
+        }
+        StageTimer timer(StageWrite);
+        for (size_t i = 0; i < plan.size(); i++) {
+            batch[i].compressedOffset = position;
+            const char* payload = (batch[i].method == MethodStored) ? plan[i].data : slab.data() + sliceOffsets[i];
+            out.write(payload, batch[i].compressedLength);
+            position += batch[i].compressedLength;
+            timer.addBytes(batch[i].compressedLength);
+            chunks.push_back(batch[i]);
+        }
+        plan.clear();
+        planBytes = 0;
+        mappedFiles.clear();
+        while (sharedBlocks.size() > 1) sharedBlocks.pop_front();
+        return static_cast<bool>(out);
+    };
+
+    // Large files go through the streaming pipeline block by block
+    auto streamMember = [&](const std::string& path, uint64_t size) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        StageTimer timer(StageStream, size);
+        uint64_t read = 0;
+        std::vector<char> carry;
+        uint64_t position = 0;
+        bool ok = runBlockPipeline(threadPool().size() * 2 + 2,
+            [&in, &carry, &position](StreamBlock& block) { return readRunAlignedBlock(in, carry, position, block); },
+            encodeStreamBlock,
+            [&](StreamBlock& block) {
+                if (!block.ok) return false;
+                const std::vector<char>& payload = (block.entry.method == MethodStored) ? block.input : block.output;
+                block.entry.compressedOffset = position;
+                out.write(payload.data(), payload.size());
+                position += payload.size();
+                read += block.input.size();
+                chunks.push_back(block.entry);
+                return static_cast<bool>(out);
+            });
+        return ok && read == size;
+    };
+
+    bool stripped = false;
+    for (const std::string& path : paths) {
+        long long size = fileSize(path);
+        if (size < 0) return fail("Failed to open " + path);
+        ArchiveMember member;
+        member.name = archiveMemberName(path, stripped);
+        if (member.name.empty()) return fail("No member name left for " + path);
+        if (member.name.size() > UINT16_MAX) return fail("Name too long: " + path);
+        member.offset = offset;
+        member.size = static_cast<uint64_t>(size);
+
+        if (member.size >= archiveBatchSize) {
+            closeSharedBlock();
+            if (!flushBatch() || !streamMember(path, member.size)) return fail("Failed to read " + path);
+        } else {
+            InputBuffer data;
+            {
+                StageTimer timer(StageRead);
+                if (size > 0) data = mapFile(path, true);
+                timer.addBytes(data.size());
+            }
+            if (data.size() != member.size) return fail("Failed to read " + path);
+            if (data.size() < archiveCoalesceLimit) {
+                std::vector<char>& block = sharedBlocks.back();
+                block.insert(block.end(), data.data(), data.data() + data.size());
+                if (block.size() >= archiveBlockSize) closeSharedBlock();
+            } else {
+                closeSharedBlock();
+                std::vector<size_t> boundaries = planChunks(data.data(), data.size(), threadPool().size());
+                for (size_t i = 0; i + 1 < boundaries.size(); i++)
+                    plan.push_back({data.data() + boundaries[i], boundaries[i + 1] - boundaries[i]});
+                planBytes += data.size();
+                mappedFiles.push_back(std::move(data));
+            }
+            if (planBytes >= archiveBatchSize && !flushBatch()) return fail("Failed to write " + partial);
+        }
+        offset += member.size;
+        members.push_back(std::move(member));
     }
+    closeSharedBlock();
+    if (!flushBatch()) return fail("Failed to write " + partial);
+    if (stripped) std::cerr << "Removed leading '/' and '../' from member names.\n";
 
-    std::cout << "File \"" << filename << "\" created.\n";
+    ContainerHeader header;
+    header.flags |= containerFlagArchive;
+    header.codec = selectedCodec;
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+    header.originalSize = offset;
+    header.tableOffset = position;
+    writeContainerHeader(headerBytes, header);
+
+    std::vector<char> table(chunks.size() * chunkEntrySize);
+    for (size_t i = 0; i < chunks.size(); i++) writeChunkEntry(table.data() + i * chunkEntrySize, chunks[i]);
+
+    std::vector<char> memberTable(4);
+    putLE<uint32_t>(memberTable.data(), static_cast<uint32_t>(members.size()));
+    for (const ArchiveMember& member : members) {
+        size_t pos = memberTable.size();
+        memberTable.resize(pos + 10 + member.name.size());
+        putLE<uint16_t>(memberTable.data() + pos, static_cast<uint16_t>(member.name.size()));
+        putLE<uint64_t>(memberTable.data() + pos + 2, member.size);
+        std::memcpy(memberTable.data() + pos + 10, member.name.data(), member.name.size());
+    }
+
+    out.write(table.data(), table.size());
+    out.write(memberTable.data(), memberTable.size());
+    out.seekp(0);
+    out.write(headerBytes, containerHeaderSize);
+    out.close();
+    if (!out || !commitPartial(outFile)) return fail("Failed to write " + outFile);
+    originalSize = offset;
+    compressedSize = position + table.size() + memberTable.size();
+    return true;
+}
+
+// Whether an archive member name is safe to create below the extraction directory
+bool safeMemberName(const std::string& name) {
+    std::filesystem::path path(name);
+    if (name.empty() || path.is_absolute() || path.has_root_name()) return false;
+    for (const auto& part : path)
+        if (part == "..") return false;
+    return true;
+}
+
+// Extract the members of an archive below outDir: every member, or only the named
+// ones. The payload is decoded through decompressRange in windows of at most
+// streamThreshold bytes, so memory stays bounded however large the archive is.
+// A full extraction reads ahead a whole window at a time, so the small members
+// sharing a chunk are served by one decode.
+bool extractArchive(const std::string& archive, const std::string& outDir,
+                    const std::vector<std::string>& names, uint64_t& extractedSize) {
+    ContainerHeader header;
+    std::vector<ArchiveMember> members;
+    if (!readArchiveIndex(archive, header, members)) return false;
+    if (!names.empty()) {
+        std::vector<ArchiveMember> wanted;
+        for (const std::string& name : names) {
+            auto it = std::find_if(members.begin(), members.end(),
+                                   [&](const ArchiveMember& member) { return member.name == name; });
+            if (it == members.end()) {
+                std::cerr << name << ": not in " << archive << "\n";
+                return false;
+            }
+            wanted.push_back(*it);
+        }
+        members.swap(wanted);
+    }
+
+    extractedSize = 0;
+    ByteBuffer window;
+    uint64_t windowStart = 0, windowEnd = 0;
+    for (const ArchiveMember& member : members) {
+        if (!safeMemberName(member.name)) {
+            std::cerr << "Refusing to extract unsafe name " << member.name << "\n";
+            return false;
+        }
+        std::filesystem::path target = std::filesystem::path(outDir) / member.name;
+        std::error_code error;
+        if (target.has_parent_path()) std::filesystem::create_directories(target.parent_path(), error);
+        DecodedFile file(target.string());
+        std::ostream& out = file.stream();
+        if (!out) {
+            std::cerr << "Failed to create " << file.path() << "\n";
+            return false;
+        }
+
+        for (uint64_t done = 0; done < member.size;) {
+            uint64_t pos = member.offset + done;
+            if (pos < windowStart || pos >= windowEnd) {
+                uint64_t length = names.empty() ? streamThreshold : std::min<uint64_t>(member.size - done, streamThreshold);
+                if (!decompressRange(archive, pos, length, window)) return false;
+                windowStart = pos;
+                windowEnd = pos + window.size();
+            }
+            uint64_t count = std::min(member.size - done, windowEnd - pos);
+            out.write(window.data() + (pos - windowStart), static_cast<std::streamsize>(count));
+            done += count;
+        }
+        if (!file.close()) {
+            std::cerr << "Failed to write " << target.string() << "\n";
+            return false;
+        }
+        extractedSize += member.size;
+    }
+    return true;
 }
 
-// Multithreaded RLE compression
+// Interactive multithreaded RLE compression
 void compressFile() {
     std::string inFile, outFile;
     std::cout << "Enter file to compress: ";
     std::getline(std::cin, inFile);
 
-    std::vector<char> data = readFile(inFile);
-    if (data.empty()) {
-        std::cerr << "Failed to read input file or file is empty.\n";
+    // Large inputs are streamed block by block instead of being loaded whole
+    if (fileSize(inFile) >= static_cast<long long>(streamThreshold)) {
+        std::cout << "Enter output file name for compressed data: ";
+        std::getline(std::cin, outFile);
+
+        uint64_t originalSize = 0, compressedSize = 0;
+        if (!streamCompressFile(inFile, outFile, originalSize, compressedSize)) return;
+        std::cout << "Original size: " << originalSize << ", Compressed size: " << compressedSize << "\n";
+        std::cout << "Compression successful (streamed).\n";
         return;
     }
 
-    // Determine how many threads to use
-    unsigned int numThreads = std::thread::hardware_concurrency();
-    if (numThreads == 0) numThreads = 2;
-
-    // Split data into chunks
-    std::vector<std::vector<char>> compressedChunks(numThreads);
-    std::vector<std::thread> threads;
-    size_t chunkSize = data.size() / numThreads;
-
-    // Launch threads for each chunk
-    for (unsigned int i = 0; i < numThreads; i++) {
-        size_t start = i * chunkSize;
-        size_t end = (i == numThreads -1) ? data.size() : start + chunkSize;
-
-        threads.emplace_back([&data, &compressedChunks, i, start, end]() {
-            compressedChunks[i] = compressRLEChunk(data, start, end);
-        });
+    InputBuffer data = mapFile(inFile);
+    if (data.empty()) {
+        std::cerr << "Failed to read input file or file is empty.\n";
+        return;
     }
 
-    // Wait for all threads to finish
-    for (auto& t : threads) t.join();
-
-    // Merge all compressed chunks
-    std::vector<char> compressed;
-    for (const auto& chunk : compressedChunks)
-        compressed.insert(compressed.end(), chunk.begin(), chunk.end());
-
-    std::cout << "Original size: " << data.size() << ", Compressed size: " << compressed.size() << "\n";
+    CompressedOutput output;
+    compressBuffer(data, output);
+    std::cout << "Original size: " << data.size() << ", Compressed size: " << output.size() << "\n";
 
     std::cout << "Enter output file name for compressed data: ";
     std::getline(std::cin, outFile);
 
-    // Store header + data
-    std::vector<char> outputData;
-    if (compressed.size() >= data.size()) {
-        std::cout << "Compression not effective. Saving uncompressed data.\n";
-        outputData.push_back('U');
-        outputData.insert(outputData.end(), data.begin(), data.end());
-    } else {
-        outputData.push_back('C');
-        outputData.insert(outputData.end(), compressed.begin(), compressed.end());
-    }
-
-    if (!writeFile(outFile, outputData)) {
+    if (output.stored) std::cout << "Compression not effective. Saving uncompressed data.\n";
+    if (!writeSegments(outFile, output.segments)) {
         std::cerr << "Failed to write compressed file.\n";
         return;
     }
@@ -148,81 +4154,630 @@ void compressFile() {
     std::cout << "Compression successful.\n";
 }
 
-// Multithreaded RLE decompression
+// Interactive multithreaded RLE decompression
 void decompressFile() {
     std::string inFile, outFile;
     std::cout << "Enter file to decompress: ";
     std::getline(std::cin, inFile);
 
-    std::vector<char> data = readFile(inFile);
+    // Containers that expand to a large output are decoded block by block
+    if (isLargeContainer(inFile)) {
+        std::cout << "Enter output filename for decompressed data: ";
+        std::getline(std::cin, outFile);
+
+        uint64_t decompressedSize = 0;
+        if (!streamDecompressFile(inFile, outFile, decompressedSize)) return;
+        std::cout << "Compressed size: " << fileSize(inFile) << ", Decompressed size: " << decompressedSize << "\n";
+        std::cout << "Decompression successful (streamed).\n";
+        return;
+    }
+
+    InputBuffer data = mapFile(inFile);
     if (data.size() < 1) {
         std::cerr << "Input file is empty or failed to read.\n";
         return;
     }
 
-    char header = data[0];
-    std::vector<char> decompressed;
+    ByteBuffer decompressed;
+    size_t payloadSize = 0;
+    std::string format;
+    if (!decompressBuffer(data, decompressed, payloadSize, format)) return;
 
-    if (header == 'C') {
-        const char* rawData = data.data() + 1;
-        size_t rawSize = data.size() - 1;
+    if (format == "uncompressed") std::cout << "Data was stored uncompressed.\n";
+    else std::cout << "Data was compressed using " << format << ".\n";
+    std::cout << "Compressed size: " << payloadSize << ", Decompressed size: " << decompressed.size() << "\n";
 
-        unsigned int numThreads = std::thread::hardware_concurrency();
-        if (numThreads == 0) numThreads = 2;
+    std::cout << "Enter output filename for decompressed data: ";
+    std::getline(std::cin, outFile);
 
-        size_t pairCount = rawSize / 2;
-        size_t pairsPerThread = pairCount / numThreads;
+    if (!writeSegments(outFile, {{decompressed.data(), decompressed.size()}}, sparseOutput)) {
+        std::cerr << "Failed to write decompressed file.\n";
+        return;
+    }
 
-        std::vector<std::vector<char>> decompressedChunks(numThreads);
-        std::vector<std::thread> threads;
+    std::cout << "Decompression successful.\n";
+}
 
-        // Decompress each chunk in its own thread
-        for (unsigned int i = 0; i < numThreads; i++) {
-            size_t startPair = i * pairsPerThread;
-            size_t endPair = (i == numThreads -1) ? pairCount : startPair + pairsPerThread;
+// Non-interactive command-line modes; ModeBatch compresses or decompresses files one by one
+enum CliMode { ModeBatch, ModeBench, ModeArchive, ModeExtract, ModeList, ModeTest };
 
-            size_t startByte = startPair * 2;
-            size_t endByte = endPair * 2;
+// Options for the non-interactive command-line modes
+struct CliOptions {
+    CliMode mode = ModeBatch;
+    bool compress = true;
+    std::string output;
+    std::vector<std::string> inputs;  // file paths, or corpus kinds for bench
+    unsigned int threads = 0;
+    size_t benchSize = 32u << 20;
+    std::string statsPath;  // --stats destination; empty when statistics are off
+    bool progress = false;
+    bool hasRange = false;  // --range: decompress only [rangeOffset, rangeOffset + rangeLength)
+    uint64_t rangeOffset = 0;
+    uint64_t rangeLength = 0;
+};
 
-            threads.emplace_back([rawData, startByte, endByte, &decompressedChunks, i]() {
-                decompressedChunks[i] = decompressRLEChunk(
-                    std::vector<char>(rawData + startByte, rawData + endByte), 0, endByte - startByte);
-            });
-        }
+void printUsage(const char* prog) {
+    std::cerr << "Usage:\n"
+              << "  " << prog << "                                      interactive menu\n"
+              << "  " << prog << " compress   [options] FILE...\n"
+              << "  " << prog << " decompress [options] FILE...\n"
+              << "  " << prog << " bench      [options] [CORPUS...]   time each stage on generated data\n"
+              << "  " << prog << " archive    -o ARCHIVE [options] FILE|DIR...\n"
+              << "  " << prog << " extract    [-o DIR] ARCHIVE [MEMBER...]\n"
+              << "  " << prog << " list       ARCHIVE...\n"
+              << "  " << prog << " test       [options] FILE...        verify checksums without writing output\n"
+              << "Options:\n"
+              << "  -o PATH      output file (one input) or existing directory (several inputs)\n"
+              << "  -j N         worker threads (default: one per hardware thread)\n"
+              << "  -l LIST      read input paths from LIST, one per line\n"
+              << "  -1 .. -9     speed/ratio preset (default -" << defaultLevel << "); -3 and -7..-9 pick\n"
+              << "               the smallest codec per chunk within a time budget\n"
+              << "  -c CODEC     use one chunk codec: varint, packbits, rle, rle16, rle32, lz77 or stored\n"
+              << "  --resume     journal streamed compression and continue an interrupted run\n"
+              << "  --pin        pin workers to CPUs, grouped by NUMA node\n"
+              << "  --sparse     leave holes for zero blocks in decompressed files\n"
+              << "  --no-mmap    read inputs with ordinary file reads instead of mmap\n"
+              << "  --no-io-uring\n"
+              << "               stream large inputs through a reader thread instead of io_uring\n"
+              << "  --scalar     use the scalar run scanner instead of SIMD (for cross-checks)\n"
+              << "  --no-sample  always run the encoder, even on chunks sampled as incompressible\n"
+              << "  --range OFFSET:LENGTH\n"
+              << "               decompress only LENGTH bytes starting at OFFSET of the original data\n"
+              << "  --progress   show bytes done, throughput and ETA on stderr while running\n"
+              << "  --stats FILE write per-stage and per-thread timings to FILE as JSON, or in the\n"
+              << "               Prometheus text format if FILE ends in .prom (\"-\" for stdout)\n"
+              << "Bench corpora: same, random, text, sparse, mixed (default: all). Bench runs at\n"
+              << "1, 2, 4 ... up to -j threads; -s MB sets the corpus size (default 32) and -o DIR\n"
+              << "the directory for scratch files.\n";
+}
 
-        // Wait for all threads to finish
-        for (auto& t : threads) t.join();
+// Parse "compress|decompress [-o PATH] [-j N] [-l LIST] [options] FILE..." or
+// "bench [-j N] [-s MB] [-o DIR] [options] [CORPUS...]", or the archive modes
+bool parseArgs(int argc, char** argv, CliOptions& options) {
+    std::string mode = argv[1];
+    if (mode == "compress") options.compress = true;
+    else if (mode == "decompress") options.compress = false;
+    else if (mode == "bench") options.mode = ModeBench;
+    else if (mode == "archive") options.mode = ModeArchive;
+    else if (mode == "extract") options.mode = ModeExtract;
+    else if (mode == "list") options.mode = ModeList;
+    else if (mode == "test") options.mode = ModeTest;
+    else return false;
 
-        // Combine all decompressed chunks
-        for (const auto& chunk : decompressedChunks)
-            decompressed.insert(decompressed.end(), chunk.begin(), chunk.end());
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "-o" || arg == "-j" || arg == "-l" || arg == "-c" || arg == "-s" || arg == "--stats" ||
+             arg == "--range") && i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        if (arg == "-o") {
+            options.output = argv[++i];
+        } else if (arg == "-j") {
+            char* end = nullptr;
+            unsigned long count = std::strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || count > 1024) {
+                std::cerr << "Invalid thread count.\n";
+                return false;
+            }
+            options.threads = static_cast<unsigned int>(count);
+        } else if (arg == "-s" && options.mode == ModeBench) {
+            char* end = nullptr;
+            unsigned long megabytes = std::strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || megabytes == 0 || megabytes > 4096) {
+                std::cerr << "Invalid bench size.\n";
+                return false;
+            }
+            options.benchSize = static_cast<size_t>(megabytes) << 20;
+        } else if (arg == "-l") {
+            std::ifstream list(argv[++i]);
+            if (!list) {
+                std::cerr << "Failed to open " << argv[i] << "\n";
+                return false;
+            }
+            std::string line;
+            while (std::getline(list, line))
+                if (!line.empty()) options.inputs.push_back(line);
+        } else if (arg == "-c") {
+            const Codec* codec = findCodec(std::string(argv[++i]));
+            if (!codec) {
+                std::cerr << "Unknown codec " << argv[i] << "\n";
+                return false;
+            }
+            selectedCodec = codec->id;
+            adaptiveCodecs.clear();
+        } else if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9') {
+            applyPreset(arg[1] - '0');
+        } else if (arg == "--no-mmap") {
+            useMmap = false;
+        } else if (arg == "--resume") {
+            resumeOutput = true;
+        } else if (arg == "--pin") {
+            pinWorkers = true;
+        } else if (arg == "--sparse") {
+            sparseOutput = true;
+        } else if (arg == "--no-io-uring") {
+#ifdef HAVE_IO_URING
+            useIoUring = false;
+#endif
+        } else if (arg == "--scalar") {
+            forceScalarKernels = true;
+        } else if (arg == "--no-sample") {
+            useSampling = false;
+        } else if (arg == "--range" && options.mode == ModeBatch && !options.compress) {
+            std::string range = argv[++i];
+            size_t colon = range.find(':');
+            char* offsetEnd = nullptr;
+            char* lengthEnd = nullptr;
+            std::string offsetText = range.substr(0, colon);
+            std::string lengthText = colon == std::string::npos ? "" : range.substr(colon + 1);
+            // strtoull() skips whitespace and negates a leading '-', so both parts
+            // must start with a digit and fit in 64 bits
+            auto digits = [](const std::string& text) { return !text.empty() && std::isdigit(static_cast<unsigned char>(text[0])); };
+            errno = 0;
+            options.rangeOffset = std::strtoull(offsetText.c_str(), &offsetEnd, 10);
+            options.rangeLength = std::strtoull(lengthText.c_str(), &lengthEnd, 10);
+            if (!digits(offsetText) || !digits(lengthText) || *offsetEnd != '\0' || *lengthEnd != '\0' || errno == ERANGE) {
+                std::cerr << "Invalid range " << range << " (expected OFFSET:LENGTH).\n";
+                return false;
+            }
+            options.hasRange = true;
+        } else if (arg == "--progress") {
+            options.progress = true;
+        } else if (arg == "--stats") {
+            options.statsPath = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option " << arg << "\n";
+            return false;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.mode == ModeArchive && options.output.empty()) {
+        std::cerr << "archive needs -o ARCHIVE\n";
+        return false;
+    }
+    return options.mode == ModeBench || !options.inputs.empty();
+}
 
-        std::cout << "Data was compressed using RLE.\n";
+// Output path for one input: -o as given, -o as a directory, or derived from the input name.
+// "-" stands for stdin/stdout; reading stdin writes stdout unless -o says otherwise.
+std::string outputPathFor(const CliOptions& options, const std::string& input) {
+    if (!options.output.empty() && options.inputs.size() == 1) return options.output;
+    if (input == "-" && options.output.empty()) return "-";
 
-    } else if (header == 'U') {
-        // File was stored uncompressed
-        decompressed = std::vector<char>(data.begin() + 1, data.end());
-        std::cout << "Data was stored uncompressed.\n";
+    std::string name = input;
+    const std::string suffix = ".rlx";
+    if (options.compress) {
+        name += suffix;
+    } else if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        name.erase(name.size() - suffix.size());
     } else {
-        std::cerr << "Unknown file format header.\n";
-        return;
+        name += ".out";
     }
 
-    std::cout << "Compressed size: " << data.size() - 1 << ", Decompressed size: " << decompressed.size() << "\n";
+    if (options.output.empty()) return name;
+    size_t slash = name.find_last_of('/');
+    std::string base = (slash == std::string::npos) ? name : name.substr(slash + 1);
+    return options.output + "/" + base;
+}
 
-    std::cout << "Enter output filename for decompressed data: ";
-    std::getline(std::cin, outFile);
+// One input file as handed from the loader thread to the batch loop
+struct LoadedInput {
+    InputBuffer input;  // memory-mapped where possible
+    bool streamed = false;
+    bool framed = false;  // handled by compressStream/decompressStream instead
+};
 
-    if (!writeFile(outFile, decompressed)) {
-        std::cerr << "Failed to write decompressed file.\n";
-        return;
+// Whether one batch item goes through the framed stream format: anything read from
+// stdin or written to stdout when compressing, and framed input when decompressing
+bool usesFramedFormat(const CliOptions& options, const std::string& input) {
+    if (input == "-") return true;
+    if (options.compress) return outputPathFor(options, input) == "-";
+    std::ifstream probe(input, std::ios::binary);
+    char magic[sizeof(framedMagic)] = {};
+    probe.read(magic, sizeof(magic));
+    return probe && isFramedStream(magic, sizeof(magic));
+}
+
+// Where per-file summaries go: stderr whenever stdout carries data or the
+// statistics, stdout otherwise
+std::ostream& summaryStream(const CliOptions& options, const std::string& output = "") {
+    return (output == "-" || options.statsPath == "-") ? std::cerr : std::cout;
+}
+
+// Compress or decompress every input; loading file N+1 overlaps with processing file N.
+// Returns the process exit status.
+int runBatch(const CliOptions& options) {
+    setThreadCount(options.threads);
+
+    // Progress counts input bytes when compressing and output bytes when decompressing
+    uint64_t totalBytes = 0;
+    if (progressEnabled) {
+        for (const std::string& input : options.inputs) {
+            uint64_t size = options.compress ? static_cast<uint64_t>(std::max(0LL, fileSize(input)))
+                                             : decompressedSizeOf(input);
+            if (options.hasRange)
+                size = size > options.rangeOffset ? std::min(options.rangeLength, size - options.rangeOffset) : 0;
+            if (size == 0 && !options.compress) {
+                totalBytes = 0;
+                break;
+            }
+            totalBytes += size;
+        }
     }
+    ProgressReporter progress(totalBytes);
 
-    std::cout << "Decompression successful.\n";
+    // Loader thread: stays at most one file ahead of the batch loop
+    std::deque<LoadedInput> loaded;
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread loader([&]() {
+        for (const std::string& input : options.inputs) {
+            LoadedInput item;
+            // Range requests read only the chunks they need, straight from the file
+            item.framed = !options.hasRange && usesFramedFormat(options, input);
+            item.streamed = !item.framed &&
+                            (options.compress ? fileSize(input) >= static_cast<long long>(streamThreshold)
+                                              : !options.hasRange && isLargeContainer(input));
+            if (!item.streamed && !item.framed && !options.hasRange) {
+                StageTimer timer(StageRead);
+                item.input = mapFile(input, true);
+                timer.addBytes(item.input.size());
+            }
+
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&]() { return loaded.size() < 1; });
+            loaded.push_back(std::move(item));
+            cv.notify_all();
+        }
+    });
+
+    int status = 0;
+    for (const std::string& input : options.inputs) {
+        LoadedInput item;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&]() { return !loaded.empty(); });
+            item = std::move(loaded.front());
+            loaded.pop_front();
+            cv.notify_all();
+        }
+
+        std::string output = outputPathFor(options, input);
+        uint64_t inSize = 0, outSize = 0;
+        bool ok = false;
+        ContainerHeader probe;
+        if (!options.compress && readContainerHeader(input, probe) && (probe.flags & containerFlagArchive)) {
+            std::cerr << input << " is an archive; use extract.\n";
+            status = 1;
+            continue;
+        }
+
+        if (item.framed) {
+            std::ifstream inFile;
+            std::ofstream outFile;
+            if (input != "-") inFile.open(input, std::ios::binary);
+            bool compressToFile = options.compress && output != "-";
+            if (compressToFile) outFile.open(partialPath(output), std::ios::binary);
+            DecodedFile decoded(options.compress ? "-" : output);
+            std::istream& in = (input == "-") ? std::cin : inFile;
+            std::ostream& out = !options.compress ? decoded.stream() : (output == "-") ? std::cout : outFile;
+            if (!in) std::cerr << "Failed to open " << input << "\n";
+            else if (!out) std::cerr << "Failed to create " << output << "\n";
+            else ok = options.compress ? compressStream(in, out, inSize, outSize)
+                                       : decompressStream(in, out, inSize, outSize) && decoded.close();
+            if (compressToFile && ok) {
+                outFile.close();
+                ok = outFile && commitPartial(output);
+            }
+            if (compressToFile && !ok) std::remove(partialPath(output).c_str());
+        } else if (options.hasRange) {
+            ByteBuffer slice;
+            ok = decompressRange(input, options.rangeOffset, options.rangeLength, slice);
+            inSize = static_cast<uint64_t>(std::max(0LL, fileSize(input)));
+            outSize = slice.size();
+            if (ok) {
+                ok = writeOutput(output, {{slice.data(), slice.size()}}, sparseOutput);
+                if (!ok) std::cerr << output << ": failed to write decompressed file.\n";
+            }
+        } else if (item.streamed) {
+            ok = options.compress ? streamCompressFile(input, output, inSize, outSize)
+                                  : streamDecompressFile(input, output, outSize);
+            if (!options.compress) inSize = static_cast<uint64_t>(fileSize(input));
+        } else if (item.input.empty()) {
+            std::cerr << input << ": failed to read input file or file is empty.\n";
+        } else if (options.compress) {
+            CompressedOutput compressed;
+            compressBuffer(item.input, compressed);
+            inSize = item.input.size();
+            outSize = compressed.size();
+            ok = writeOutput(output, compressed.segments);
+            if (!ok) std::cerr << output << ": failed to write compressed file.\n";
+        } else {
+            ByteBuffer decompressed;
+            size_t payloadSize = 0;
+            std::string format;
+            ok = decompressBuffer(item.input, decompressed, payloadSize, format);
+            inSize = item.input.size();
+            outSize = decompressed.size();
+            if (ok) {
+                ok = writeOutput(output, {{decompressed.data(), decompressed.size()}}, sparseOutput);
+                if (!ok) std::cerr << output << ": failed to write decompressed file.\n";
+            }
+        }
+
+        if (ok) progress.print(input + " -> " + output + " (" + std::to_string(inSize) + " -> " + std::to_string(outSize) + " bytes)\n",
+                               summaryStream(options, output));
+        else status = 1;
+    }
+
+    loader.join();
+    return status;
+}
+
+// Synthetic corpus kinds understood by generateCorpus() and the bench mode
+const char* const benchCorpora[] = {"same", "random", "text", "sparse", "mixed"};
+
+// Deterministic synthetic input of `size` bytes: "same" is a single repeated byte,
+// "random" incompressible noise, "text" words and line breaks, "sparse" zero fill with
+// short random records, "mixed" 64 KiB stretches of the other four in turn.
+// Returns an empty vector for an unknown kind.
+std::vector<char> generateCorpus(const std::string& kind, size_t size, uint64_t seed = 1) {
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    std::vector<char> data;
+    data.reserve(size);
+    if (kind == "same") {
+        data.assign(size, 'A');
+    } else if (kind == "random") {
+        while (data.size() < size) {
+            uint64_t word = next();
+            for (int b = 0; b < 8 && data.size() < size; b++) data.push_back(static_cast<char>(word >> (b * 8)));
+        }
+    } else if (kind == "text") {
+        static const char* const words[] = {
+            "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on",
+            "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they",
+            "compression", "thread"};
+        while (data.size() < size) {
+            // Squaring the draw favours the common words, roughly like real prose
+            uint64_t r = next() % 32;
+            const char* word = words[(r * r) / 32];
+            data.insert(data.end(), word, word + std::strlen(word));
+            data.push_back((next() % 12 == 0) ? '\n' : ' ');
+        }
+        data.resize(size);
+    } else if (kind == "sparse") {
+        data.assign(size, 0);
+        for (size_t pos = next() % 8192; pos < size; pos += 1024 + next() % 14336) {
+            size_t length = std::min<size_t>(16 + next() % 240, size - pos);
+            for (size_t i = 0; i < length; i++) data[pos + i] = static_cast<char>(next());
+        }
+    } else if (kind == "mixed") {
+        const size_t stretch = 64u << 10;
+        for (size_t k = 0; data.size() < size; k++) {
+            std::vector<char> part = generateCorpus(benchCorpora[k % 4], std::min(stretch, size - data.size()), seed + k);
+            data.insert(data.end(), part.begin(), part.end());
+        }
+    }
+    return data;
+}
+
+// Best-of-three wall time of fn in seconds
+double benchTime(const std::function<void()>& fn) {
+    double best = 0;
+    for (int run = 0; run < 3; run++) {
+        auto started = std::chrono::steady_clock::now();
+        fn();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Time each stage on generated corpora at 1, 2, 4 ... up to the configured thread count.
+// Scratch files go to the -o directory (default: current directory) and are removed.
+// Returns the process exit status.
+int runBench(const CliOptions& options) {
+    const size_t size = options.benchSize;
+    std::vector<std::string> kinds = options.inputs;
+    if (kinds.empty()) kinds.assign(std::begin(benchCorpora), std::end(benchCorpora));
+
+    setThreadCount(options.threads);
+    unsigned int maxThreads = threadPool().size();
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    std::string dir = options.output.empty() ? "." : options.output;
+    std::string rawPath = dir + "/bench-input.tmp";
+    std::string packedPath = dir + "/bench-packed.tmp";
+
+    std::cout << "Throughput in MB/s of uncompressed data, " << size << " bytes per corpus, best of 3\n";
+    std::cout << std::left << std::setw(8) << "corpus" << std::right << std::setw(8) << "threads"
+              << std::setw(10) << "read" << std::setw(10) << "compress" << std::setw(10) << "write"
+              << std::setw(12) << "decompress" << std::setw(11) << "ratio" << "\n";
+
+    int status = 0;
+    for (const std::string& kind : kinds) {
+        std::vector<char> corpus = generateCorpus(kind, size);
+        if (corpus.empty()) {
+            std::cerr << "Unknown corpus " << kind << "\n";
+            status = 1;
+            continue;
+        }
+        if (!writeSegments(rawPath, {{corpus.data(), corpus.size()}})) {
+            std::cerr << "Failed to write " << rawPath << "\n";
+            status = 1;
+            break;
+        }
+
+        for (unsigned int threads : threadCounts) {
+            setThreadCount(threads);
+            threadPool();  // start the workers outside the timed regions
+
+            // Read: load the file the way the CLI does, touching mapped pages so
+            // the fault cost is not deferred into the compress stage
+            InputBuffer input;
+            double readSeconds = benchTime([&]() {
+                input = mapFile(rawPath);
+                volatile char sink = 0;
+                for (size_t i = 0; i < input.size(); i += 4096) sink = sink + input.data()[i];
+            });
+
+            CompressedOutput compressed;
+            double compressSeconds = benchTime([&]() {
+                compressed = CompressedOutput();
+                compressBuffer(input, compressed);
+            });
+            bool ok = true;
+            double writeSeconds = benchTime([&]() { ok = writeSegments(packedPath, compressed.segments) && ok; });
+
+            InputBuffer packed = mapFile(packedPath);
+            ByteBuffer decompressed;
+            double decompressSeconds = benchTime([&]() {
+                size_t payloadSize = 0;
+                std::string format;
+                ok = decompressBuffer(packed, decompressed, payloadSize, format) && ok;
+            });
+            ok = ok && decompressed.size() == corpus.size() &&
+                 std::memcmp(decompressed.data(), corpus.data(), corpus.size()) == 0;
+            if (!ok) {
+                std::cerr << kind << ": round trip failed with " << threads << " threads.\n";
+                status = 1;
+            }
+
+            auto rate = [&](double seconds) { return seconds > 0 ? static_cast<double>(size) / 1e6 / seconds : 0.0; };
+            std::cout << std::left << std::setw(8) << kind << std::right << std::setw(8) << threads
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(10) << rate(readSeconds) << std::setw(10) << rate(compressSeconds)
+                      << std::setw(10) << rate(writeSeconds) << std::setw(12) << rate(decompressSeconds)
+                      << std::setprecision(3)
+                      << std::setw(11) << static_cast<double>(size) / static_cast<double>(compressed.size()) << "\n";
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    }
+
+    std::remove(rawPath.c_str());
+    std::remove(packedPath.c_str());
+    setThreadCount(options.threads);
+    return status;
+}
+
+// Verify every input; returns the process exit status
+int runTest(const CliOptions& options) {
+    setThreadCount(options.threads);
+    int status = 0;
+    for (const std::string& input : options.inputs) {
+        std::string summary;
+        if (testCompressedFile(input, summary)) {
+            summaryStream(options) << input << ": OK (" << summary << ")\n";
+        } else {
+            summaryStream(options) << input << ": FAILED\n";
+            status = 1;
+        }
+    }
+    return status;
 }
 
-// Main program loop
-int main() {
+// Run the archive, extract and list modes. Returns the process exit status.
+int runArchiveMode(const CliOptions& options) {
+    setThreadCount(options.threads);
+    if (options.mode == ModeArchive) {
+        uint64_t inSize = 0, outSize = 0;
+        if (!createArchive(options.inputs, options.output, inSize, outSize)) return 1;
+        summaryStream(options) << options.output << " (" << inSize << " -> " << outSize << " bytes)\n";
+        return 0;
+    }
+    if (options.mode == ModeExtract) {
+        std::vector<std::string> names(options.inputs.begin() + 1, options.inputs.end());
+        uint64_t extracted = 0;
+        if (!extractArchive(options.inputs[0], options.output.empty() ? "." : options.output, names, extracted))
+            return 1;
+        summaryStream(options) << options.inputs[0] << " -> " << (options.output.empty() ? "." : options.output)
+                  << " (" << extracted << " bytes)\n";
+        return 0;
+    }
+
+    int status = 0;
+    for (const std::string& archive : options.inputs) {
+        ContainerHeader header;
+        std::vector<ArchiveMember> members;
+        if (!readArchiveIndex(archive, header, members)) {
+            status = 1;
+            continue;
+        }
+        if (options.inputs.size() > 1) std::cout << archive << ":\n";
+        for (const ArchiveMember& member : members)
+            std::cout << std::setw(12) << member.size << "  " << member.name << "\n";
+    }
+    return status;
+}
+
+// Interactive worker thread count selection (0 = one per hardware thread)
+void setThreadsInteractive() {
+    std::string countStr;
+    std::cout << "Enter number of worker threads (0 for automatic): ";
+    std::getline(std::cin, countStr);
+
+    char* end = nullptr;
+    unsigned long count = std::strtoul(countStr.c_str(), &end, 10);
+    if (countStr.empty() || *end != '\0' || count > 1024) {
+        std::cerr << "Invalid thread count.\n";
+        return;
+    }
+    setThreadCount(static_cast<unsigned int>(count));
+    std::cout << "Using " << threadPool().size() << " worker threads.\n";
+}
+
+// Command-line modes when arguments are given, otherwise the interactive menu loop
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        CliOptions options;
+        if (!parseArgs(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 2;
+        }
+        statsEnabled = !options.statsPath.empty();
+        progressEnabled = options.progress && options.mode == ModeBatch;
+        int status = 0;
+        switch (options.mode) {
+        case ModeBatch: status = runBatch(options); break;
+        case ModeBench: status = runBench(options); break;
+        case ModeTest: status = runTest(options); break;
+        default: status = runArchiveMode(options); break;
+        }
+        if (statsEnabled && !writeStats(options.statsPath, resolvedThreadCount())) status = 1;
+        return status;
+    }
+
     std::cout << "Multithreaded File Compressor/Decompressor using RLE\n";
 
     while (true) {
@@ -231,6 +4786,7 @@ int main() {
         std::cout << "2. Compress a file\n";
         std::cout << "3. Decompress a file\n";
         std::cout << "4. Exit\n";
+        std::cout << "5. Set number of worker threads\n";
         std::cout << "Enter choice: ";
 
         std::string choiceStr;
@@ -245,6 +4801,8 @@ int main() {
         } else if (choiceStr == "4") {
             std::cout << "Goodbye!\n";
             break;
+        } else if (choiceStr == "5") {
+            setThreadsInteractive();
         } else {
             std::cout << "Invalid choice. Try again.\n";
         }